@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2013 Kiran Mathew Koshy
+ * Copyright (C) 2026 Matthieu Gautier <mgautier@kymeria.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "diffchain.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+
+#include <zim/item.h>
+#include <zim/uuid.h>
+
+bool isAdditionalMetadata(const std::string& url)
+{
+   if(url=="M/dlist")
+       return true;
+   if(url=="M/startfileuid")
+       return true;
+   if(url=="M/endfileuid")
+       return true;
+   if(url=="M/mainaurl")
+       return true;
+   if(url=="M/layoutaurl")
+       return true;
+   if(url=="M/redirectlist")
+       return true;
+   if(url=="M/unchangedclusters")
+       return true;
+   if(url=="M/deltalist")
+       return true;
+   return false;
+}
+
+std::string getOptionalMetadata(const zim::Archive& archive, const std::string& name)
+{
+  auto keys = archive.getMetadataKeys();
+  if (std::find(keys.begin(), keys.end(), name) == keys.end()) {
+    return "";
+  }
+  return archive.getMetadata(name);
+}
+
+std::string readUuidMetadata(const zim::Archive& diff_archive, const std::string& name)
+{
+  std::string uuid;
+  std::istringstream stream(diff_archive.getMetadata(name));
+  for (std::string line; uuid.size() < 16 && std::getline(stream, line);) {
+    uuid += (char) atoi(line.c_str());
+  }
+  uuid.resize(16, '\0');
+  return uuid;
+}
+
+PathLookup archiveLookup(const zim::Archive& archive)
+{
+  return [&archive](const std::string& path, zim::entry_index_type& index) {
+    if (!archive.hasEntryByPath(path)) {
+      return false;
+    }
+    index = archive.getEntryByPath(path).getIndex();
+    return true;
+  };
+}
+
+Bitset readEntrySet(const zim::Archive& diff_archive, const std::string& name,
+                    zim::entry_index_type startEntryCount, const PathLookup& lookup)
+{
+  auto data = getOptionalMetadata(diff_archive, name);
+  if (Bitset::isEncoded(data.data(), data.size())) {
+    return Bitset::decode(data.data(), data.size());
+  }
+
+  Bitset entries(startEntryCount);
+  std::istringstream stream(data);
+  zim::entry_index_type index;
+  for (std::string path; std::getline(stream, path);) {
+    if (lookup(path, index)) {
+      entries.set(index);
+    }
+  }
+  return entries;
+}
+
+std::string readRedirectList(const zim::Archive& diff_archive, const PathLookup& lookup)
+{
+  auto data = getOptionalMetadata(diff_archive, "redirectlist");
+  if (RedirectListReader::isEncoded(data.data(), data.size())) {
+    return data;
+  }
+
+  std::vector<std::pair<zim::entry_index_type, std::string>> redirects;
+  std::istringstream stream(data);
+  zim::entry_index_type index;
+  for (std::string path, target; std::getline(stream, path) && std::getline(stream, target);) {
+    if (lookup(path, index)) {
+      redirects.push_back(std::make_pair(index, target));
+    }
+  }
+  std::sort(redirects.begin(), redirects.end());
+
+  RedirectListWriter writer;
+  for (auto& redirect:redirects) {
+    writer.add(redirect.first, redirect.second);
+  }
+  return writer.data();
+}
+
+DiffChain::DiffChain(const std::string& start_filename, const std::vector<std::string>& diff_filenames)
+{
+  if (diff_filenames.size() >= UINT16_MAX) {
+    throw std::runtime_error("Too many diff files");
+  }
+  archives.push_back(zim::Archive(start_filename));
+  const auto startUuid = archives.front().getUuid();
+  std::string previousUuid(startUuid.data, 16);
+  for (auto& diff_filename:diff_filenames) {
+    zim::Archive diff_archive(diff_filename);
+    if (readUuidMetadata(diff_archive, "startfileuid") != previousUuid) {
+      throw std::runtime_error(Formatter() << "The diff file " << diff_filename
+                                           << " does not apply on the previous file of the chain.");
+    }
+    previousUuid = readUuidMetadata(diff_archive, "endfileuid");
+    archives.push_back(diff_archive);
+  }
+
+  const auto entryCount = archives.front().getEntryCount();
+  entries.reserve(entryCount);
+  for (zim::entry_index_type index = 0; index < entryCount; index++) {
+    EntrySource source;
+    source.index = index;
+    source.archive = 0;
+    source.deltaCount = 0;
+    source.deltaBegin = 0;
+    entries.push_back(source);
+  }
+  for (uint16_t diffIndex = 1; diffIndex < archives.size(); diffIndex++) {
+    apply(diffIndex);
+  }
+}
+
+zim::Entry DiffChain::getEntry(const EntrySource::Location& location) const
+{
+  return archives[location.first].getEntryByPath(location.second);
+}
+
+zim::Entry DiffChain::getEntry(zim::entry_index_type pos) const
+{
+  const auto& source = entries[pos];
+  if (source.deltaCount) {
+    return getEntry(deltas[source.deltaBegin + source.deltaCount - 1]);
+  }
+  return getEntry(source.location());
+}
+
+std::string DiffChain::getMimetype(zim::entry_index_type pos) const
+{
+  return getEntry(entries[pos].location()).getItem().getMimetype();
+}
+
+std::string DiffChain::getRedirectTarget(zim::entry_index_type pos) const
+{
+  auto it = std::lower_bound(redirectTargets.begin(), redirectTargets.end(), pos,
+    [](const std::pair<zim::entry_index_type, std::string>& redirect, zim::entry_index_type pos) { return redirect.first < pos; });
+  if (it != redirectTargets.end() && it->first == pos) {
+    return it->second;
+  }
+  auto entry = getEntry(pos);
+  if (entry.isRedirect()) {
+    return entry.getRedirectEntry().getPath();
+  }
+  return "";
+}
+
+std::string DiffChain::getContent(zim::entry_index_type pos) const
+{
+  const auto& source = entries[pos];
+  auto blob = getEntry(source.location()).getItem().getData();
+  std::string content(blob.data(), blob.size());
+  for (auto i = source.deltaBegin; i < source.deltaBegin + source.deltaCount; i++) {
+    auto delta = getEntry(deltas[i]).getItem().getData();
+    content = applyDelta(content.data(), content.size(), delta.data(), delta.size());
+  }
+  return content;
+}
+
+bool DiffChain::findEntry(const std::string& path, zim::entry_index_type& pos) const
+{
+  auto it = std::lower_bound(entries.begin(), entries.end(), path,
+    [&](const EntrySource& source, const std::string& path) { return getEntry(source.location()).getPath() < path; });
+  if (it == entries.end() || getEntry(it->location()).getPath() != path) {
+    return false;
+  }
+  pos = it - entries.begin();
+  return true;
+}
+
+// Same walk than zimpatch, but the current file is the list of sources.
+// The index of an entry in the current file is its position in the list.
+// The sources, their deltas and the redirect targets are rebuilt in new
+// lists, in the same order.
+void DiffChain::apply(uint16_t diffIndex)
+{
+  const auto& diff_archive = archives[diffIndex];
+  auto getPath = [&](const EntrySource& source) {
+    return getEntry(source.location()).getPath();
+  };
+  const PathLookup lookup = [this](const std::string& path, zim::entry_index_type& pos) {
+    return findEntry(path, pos);
+  };
+
+  const auto dlist = readEntrySet(diff_archive, "dlist", entries.size(), lookup);
+  const auto deltaList = readEntrySet(diff_archive, "deltalist", entries.size(), lookup);
+  const auto redirectData = readRedirectList(diff_archive, lookup);
+  RedirectListReader redirectList(redirectData.data(), redirectData.size());
+
+  std::vector<EntrySource> result;
+  std::vector<EntrySource::Location> resultDeltas;
+  std::vector<std::pair<zim::entry_index_type, std::string>> resultRedirects;
+  result.reserve(entries.size());
+  resultDeltas.reserve(deltas.size());
+
+  // Add a source of the diff file.
+  auto addNew = [&](const zim::Entry& entry) {
+    EntrySource source;
+    source.index = entry.getIndex();
+    source.archive = diffIndex;
+    source.deltaCount = 0;
+    source.deltaBegin = 0;
+    result.push_back(source);
+  };
+  // Keep a source of the current file, with its deltas.
+  auto keep = [&](EntrySource source) {
+    const auto deltaBegin = resultDeltas.size();
+    if (deltaBegin + source.deltaCount + 1 > UINT32_MAX) {
+      throw std::runtime_error("Too many deltas in the chain of diff files");
+    }
+    resultDeltas.insert(resultDeltas.end(),
+                        deltas.begin() + source.deltaBegin,
+                        deltas.begin() + source.deltaBegin + source.deltaCount);
+    source.deltaBegin = deltaBegin;
+    result.push_back(source);
+  };
+
+  auto redirectIt = redirectTargets.begin();
+  auto diffRange = diff_archive.iterByPath();
+  auto diffIt = diffRange.begin();
+  zim::entry_index_type index = 0;
+  while (index < entries.size() || diffIt != diffRange.end()) {
+    int cmp;
+    if (index == entries.size()) {
+      cmp = 1;
+    } else if (diffIt == diffRange.end()) {
+      cmp = -1;
+    } else {
+      cmp = getPath(entries[index]).compare(diffIt->getPath());
+    }
+
+    if (cmp > 0) {
+      //New article in the diff file.
+      if (!isAdditionalMetadata(diffIt->getPath())) {
+        addNew(*diffIt);
+      }
+      ++diffIt;
+      continue;
+    }
+
+    // The redirect target of the current entry, if it has one.
+    while (redirectIt != redirectTargets.end() && redirectIt->first < index) {
+      ++redirectIt;
+    }
+    const bool hasRedirectTarget = redirectIt != redirectTargets.end() && redirectIt->first == index;
+
+    auto source = entries[index];
+    if (dlist.test(index)) {
+      // Deleted.
+    } else if (redirectList.seek(index)) {
+      source.deltaCount = 0;
+      resultRedirects.push_back(std::make_pair(result.size(), redirectList.target()));
+      keep(source);
+    } else if (cmp < 0) {
+      if (hasRedirectTarget) {
+        resultRedirects.push_back(std::make_pair(result.size(), std::move(redirectIt->second)));
+      }
+      keep(source);
+    } else if (!diffIt->isRedirect() && deltaList.test(index)) {
+      keep(source);
+      result.back().deltaCount++;
+      resultDeltas.push_back(EntrySource::Location(diffIndex, diffIt->getIndex()));
+    } else {
+      addNew(*diffIt);
+    }
+
+    ++index;
+    if (cmp == 0) {
+      ++diffIt;
+    }
+  }
+  entries.swap(result);
+  deltas.swap(resultDeltas);
+  redirectTargets.swap(resultRedirects);
+}
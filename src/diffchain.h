@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2013 Kiran Mathew Koshy
+ * Copyright (C) 2026 Matthieu Gautier <mgautier@kymeria.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENZIM_DIFFCHAIN_H
+#define OPENZIM_DIFFCHAIN_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include <zim/archive.h>
+#include <zim/entry.h>
+
+#include "tools.h"
+
+// Helpers to read the diff files made by zimdiff.
+
+// Metadata added by zimdiff, which are not part of the patched file.
+bool isAdditionalMetadata(const std::string& url);
+
+// Return an empty string if the metadata doesn't exist.
+std::string getOptionalMetadata(const zim::Archive& archive, const std::string& name);
+
+// Return the raw 16 bytes of a uuid stored by zimdiff (one number per line).
+std::string readUuidMetadata(const zim::Archive& diff_archive, const std::string& name);
+
+// Find the index of the entry of the start file at `path`.
+// Only used to read the lists of paths of old diff files.
+typedef std::function<bool (const std::string& path, zim::entry_index_type& index)> PathLookup;
+PathLookup archiveLookup(const zim::Archive& archive);
+
+// Read a set of entries of the start file stored in the diff file metadata.
+// Old diff files store the paths of the entries, one per line.
+Bitset readEntrySet(const zim::Archive& diff_archive, const std::string& name,
+                    zim::entry_index_type startEntryCount, const PathLookup& lookup);
+
+// Read the list of the entries of the start file which are redirects in the
+// end file. Old diff files store a path and its target per pair of lines,
+// they are converted to the current encoding.
+std::string readRedirectList(const zim::Archive& diff_archive, const PathLookup& lookup);
+
+// Where an entry of the patched file comes from.
+// The chain keeps one source per entry, so it is kept small: the redirect
+// targets and the deltas are stored apart, in the DiffChain.
+struct EntrySource
+{
+  typedef std::pair<uint16_t, zim::entry_index_type> Location;
+
+  // The entry in the start file (archive 0) or in a diff file (archive i).
+  zim::entry_index_type index;
+  uint16_t archive;
+  // Number of deltas to apply, in order, on the content of the entry.
+  // They start at `deltaBegin` in the deltas of the chain.
+  uint16_t deltaCount;
+  uint32_t deltaBegin;
+
+  Location location() const { return Location(archive, index); }
+};
+
+// Apply a chain of diff files on a start file, without creating the
+// intermediate files: the state of each intermediate file is the list of
+// the sources of its entries, in path order.
+// The entries are referred to by their position in this list.
+class DiffChain
+{
+  public:
+    // Throw a std::runtime_error if a diff file doesn't apply on the
+    // previous file of the chain.
+    DiffChain(const std::string& start_filename, const std::vector<std::string>& diff_filenames);
+
+    // The number of entries of the final file.
+    zim::entry_index_type size() const { return entries.size(); }
+    const EntrySource& getSource(zim::entry_index_type pos) const { return entries[pos]; }
+
+    const zim::Archive& getStartArchive() const { return archives.front(); }
+    const zim::Archive& getLastDiffArchive() const { return archives.back(); }
+
+    // Find the position of the entry at `path` in the entries.
+    bool findEntry(const std::string& path, zim::entry_index_type& pos) const;
+
+    // The entry giving the path and title of the entry at `pos`.
+    zim::Entry getEntry(zim::entry_index_type pos) const;
+
+    // The mimetype of the content of an entry which is not a redirect.
+    // The deltas are stored as "application/octet-stream", the mimetype is
+    // the one of the entry they apply on.
+    std::string getMimetype(zim::entry_index_type pos) const;
+
+    // Return an empty string if the entry is not a redirect.
+    std::string getRedirectTarget(zim::entry_index_type pos) const;
+
+    // The content of the entry, with its deltas applied.
+    std::string getContent(zim::entry_index_type pos) const;
+
+  private:
+    zim::Entry getEntry(const EntrySource::Location& location) const;
+    void apply(uint16_t diffIndex);
+
+    std::vector<zim::Archive> archives;
+    std::vector<EntrySource> entries;
+    // The deltas of all the entries, each entry using a range of them.
+    std::vector<EntrySource::Location> deltas;
+    // The redirect targets set by the redirect lists, by position of the
+    // entry, in increasing order.
+    std::vector<std::pair<zim::entry_index_type, std::string>> redirectTargets;
+};
+
+#endif  // OPENZIM_DIFFCHAIN_H
@@ -21,55 +21,152 @@
 #ifndef _ZIM_TOOL_PROGRESS_H_
 #define _ZIM_TOOL_PROGRESS_H_
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
 
-using TimePoint = std::chrono::system_clock::time_point;
-
-class ProgressBar //Class for implementing a progress bar(used in redundancy, url and MIME checks).
+// Progress report of a loop over a number of items, with the rate of items
+// (and bytes) per second and, if the number of items is known, the remaining
+// time.
+// report() can be called from several threads at the same time: each thread
+// counts on its own shard, and the clock is only read every CHECK_EVERY
+// items of a shard. It costs a single relaxed load if reporting is disabled.
+class ProgressBar
 {
 private:
+    using Clock = std::chrono::steady_clock;
+
+    static const unsigned SHARD_COUNT = 16;
+    static const uint64_t CHECK_EVERY = 64;
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> items;
+        std::atomic<uint64_t> bytes;
+    };
+
     double time_interval; // The time interval a report will be printed.
-    TimePoint last_report_time; // Last time a report has been printed.
-    int max_no;     //Maximum no of times report() will be called.
-    int counter;    //Number of times report() has been called(at a particular time).
-    bool report_progress; //Boolean value to store wether report should display any characters.
+    std::ostream* out;    // Where the reports are printed.
+    std::atomic<bool> report_progress; // Whether report() prints anything.
+    uint64_t max_no;      // Number of items of the loop.
+    Clock::time_point start_time;
+    std::atomic<int64_t> next_report; // Time of the next report, in ns since start_time.
+    std::atomic<bool> started; // Whether a report has been printed since reset().
+    Shard shards[SHARD_COUNT];
+
+    static unsigned shardIndex()
+    {
+        static std::atomic<unsigned> threadCount(0);
+        static thread_local unsigned index = threadCount++ % SHARD_COUNT;
+        return index;
+    }
+
+    int64_t elapsed() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time).count();
+    }
+
+    void print(int64_t elapsed_ns, bool last)
+    {
+        uint64_t items = 0, bytes = 0;
+        for (auto& shard: shards) {
+            items += shard.items.load(std::memory_order_relaxed);
+            bytes += shard.bytes.load(std::memory_order_relaxed);
+        }
+        const double seconds = elapsed_ns / 1e9;
+        const double rate = seconds > 0 ? items / seconds : 0;
+        *out << "\r" << items;
+        if (max_no) {
+            *out << "/" << max_no << " (" << items * 100 / max_no << "%)";
+        }
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), " %.0f items/s", rate);
+        *out << buffer;
+        if (bytes) {
+            snprintf(buffer, sizeof(buffer), ", %.1f MB/s", seconds > 0 ? bytes / seconds / 1e6 : 0);
+            *out << buffer;
+        }
+        if (last) {
+            // Pad to erase the end of a longer previous report.
+            snprintf(buffer, sizeof(buffer), " in %.1fs%16s", seconds, "");
+            *out << buffer << std::endl;
+            return;
+        }
+        if (rate > 0 && items < max_no) {
+            const auto eta = uint64_t((max_no - items) / rate);
+            snprintf(buffer, sizeof(buffer), ", ETA %u:%02u:%02u  ",
+                     unsigned(eta / 3600), unsigned(eta / 60 % 60), unsigned(eta % 60));
+            *out << buffer;
+        }
+        *out << std::flush;
+    }
 
 public:
-    ProgressBar(double time_interval)
+    explicit ProgressBar(double time_interval, std::ostream& out = std::cout)
       : time_interval(time_interval),
+        out(&out),
+        report_progress(false),
         max_no(0),
-        counter(0),
-        report_progress(false)
-    { }
+        next_report(0),
+        started(false)
+    {
+        reset(0);
+    }
+
+    ProgressBar(const ProgressBar&) = delete;
+    ProgressBar& operator=(const ProgressBar&) = delete;
 
-    void reset(int max_n)
+    ~ProgressBar()
     {
+        finish();
+    }
+
+    // Start a new loop of max_n items (0 if unknown). Not thread safe.
+    void reset(uint64_t max_n)
+    {
+        finish();
         max_no = max_n;
-        counter=0;
-        last_report_time=TimePoint();
-        time_interval=1;
+        for (auto& shard: shards) {
+            shard.items.store(0, std::memory_order_relaxed);
+            shard.bytes.store(0, std::memory_order_relaxed);
+        }
+        start_time = Clock::now();
+        next_report.store(0, std::memory_order_relaxed);
+        started = false;
     }
 
-    void report()
+    // One more item has been processed, of `bytes` bytes.
+    void report(uint64_t bytes = 0)
     {
-        if(counter >= max_no)
+        if (!report_progress.load(std::memory_order_relaxed))
             return;
 
-        counter++;
-
-        if(!report_progress)
+        auto& shard = shards[shardIndex()];
+        const auto items = shard.items.fetch_add(1, std::memory_order_relaxed);
+        if (bytes) {
+            shard.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+        if (items % CHECK_EVERY != 0)
             return;
 
-        auto now = std::chrono::system_clock::now();
-        std::chrono::duration<double> duration = now-last_report_time;
-        if (duration.count() > time_interval) {
-            std::cout << "\r" << counter << "/" << max_no << std::flush;
-            last_report_time = now;
+        // Only the thread moving next_report forward prints the report.
+        const auto now = elapsed();
+        auto next = next_report.load(std::memory_order_relaxed);
+        if (now >= next
+         && next_report.compare_exchange_strong(next, now + int64_t(time_interval * 1e9))) {
+            started = true;
+            print(now, false);
         }
-        if(counter == max_no)
-        {
-            std::cout << "\r" << counter << "/" << max_no << std::endl;
+    }
+
+    // Print the final report of the loop, if anything has been reported.
+    // Called by reset() and the destructor. Not thread safe.
+    void finish()
+    {
+        if (started) {
+            print(elapsed(), true);
+            started = false;
         }
     }
 
@@ -34,6 +34,10 @@
 #include <algorithm>
 #include <regex>
 
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+
 #ifdef _WIN32
 #define SEPARATOR "\\"
 #else
@@ -112,27 +116,73 @@ std::string base64_encode(unsigned char const* bytes_to_encode,
   return ret;
 }
 
-static char charFromHex(std::string a)
+namespace
 {
-  std::istringstream Blat(a);
-  int Z;
-  Blat >> std::hex >> Z;
-  return char(Z);
+
+// Value of an hexadecimal digit, -1 for the other characters.
+const signed char HEX_VALUES[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+// Decode the "%XX" sequence at p, if valid and before end.
+inline bool decodeHex(const char* p, const char* end, char& ch)
+{
+  if (end - p < 3) {
+    return false;
+  }
+  const int high = HEX_VALUES[static_cast<unsigned char>(p[1])];
+  const int low = HEX_VALUES[static_cast<unsigned char>(p[2])];
+  if (high < 0 || low < 0) {
+    return false;
+  }
+  ch = char((high << 4) | low);
+  return true;
 }
 
-std::string decodeUrl(const std::string& originalUrl)
+} // unnamed namespace
+
+void decodeUrl(const char* data, size_t size, std::string& output)
 {
-  std::string url = originalUrl;
-  std::string::size_type pos = 0;
-  while ((pos = url.find('%', pos)) != std::string::npos
-         && pos + 2 < url.length()) {
-    if (!isxdigit(url[pos+1]) || !isxdigit(url[pos+2])) {
-      ++pos;
-      continue;
+  output.clear();
+  const char* const end = data + size;
+  const char* p = data;
+  while (p < end) {
+    const char* percent = static_cast<const char*>(memchr(p, '%', end - p));
+    if (!percent) {
+      break;
+    }
+    output.append(p, percent - p);
+    char ch;
+    if (decodeHex(percent, end, ch)) {
+      output += ch;
+      p = percent + 3;
+    } else {
+      output += '%';
+      p = percent + 1;
     }
-    url.replace(pos, 3, 1, charFromHex(url.substr(pos + 1, 2)));
-    ++pos;
   }
+  output.append(p, end - p);
+}
+
+std::string decodeUrl(const std::string& originalUrl)
+{
+  std::string url;
+  decodeUrl(originalUrl.data(), originalUrl.size(), url);
   return url;
 }
 
@@ -255,66 +305,824 @@ std::vector<html_link> generic_getLinks(const std::string& page)
     return links;
 }
 
-bool isOutofBounds(const std::string& input, std::string base)
+bool isOutofBounds(const std::string& input, const std::string& base)
 {
-    if (input.empty()) return false;
+    std::string output;
+    return !normalizeLink(input.data(), input.size(), base.data(), base.size(), output);
+}
 
-    if (!base.length() || base.back() != '/')
-        base.push_back('/');
+namespace
+{
 
-    int nr = 0;
-    if (base.front() != '/')
-        nr++;
+const uint32_t ADLER_BASE = 65521;
+// Largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1: the modulo
+// can be deferred for this many bytes without overflowing the sums.
+const size_t ADLER_NMAX = 5552;
 
-    //count nr of substrings ../
-    int nrsteps = 0;
-    std::string::size_type pos = 0;
-    while((pos = input.find("../", pos)) != std::string::npos) {
-        nrsteps++;
-        pos += 3;
+uint32_t adler32Scalar(const unsigned char* data, size_t size, uint32_t s1, uint32_t s2)
+{
+  while (size > 0) {
+    size_t n = std::min(size, ADLER_NMAX);
+    size -= n;
+    for (; n > 0; n--) {
+      s1 += *data++;
+      s2 += s1;
     }
+    s1 %= ADLER_BASE;
+    s2 %= ADLER_BASE;
+  }
+  return (s2 << 16) | s1;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ADLER32_AVX2
 
-    return nrsteps >= (nr + std::count(base.cbegin(), base.cend(), '/'));
+__attribute__((target("avx2")))
+uint32_t hsum32(__m256i v)
+{
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
 }
 
-int adler32(const std::string& buf)
+// Process the data by blocks of 32 bytes. For a block x[0..31]:
+//   s1 += sum(x[i])
+//   s2 += 32*s1 + sum((32-i)*x[i])
+// The s1 before each block are accumulated in `prev` and multiplied by 32
+// once per chunk of NMAX bytes.
+__attribute__((target("avx2")))
+uint32_t adler32Avx2(const unsigned char* data, size_t size)
 {
-    unsigned int s1 = 1;
-    unsigned int s2 = 0;
-    unsigned int sz=buf.size();
-    for (size_t n = 0; n <sz; n++)
-    {
-        s1 = (s1 + buf[n]) % 65521;
-        s2 = (s2 + s1) % 65521;
+  const size_t BLOCK = 32;
+  const __m256i weights = _mm256_set_epi8(
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32);
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i zero = _mm256_setzero_si256();
+  uint32_t s1 = 1;
+  uint32_t s2 = 0;
+  while (size >= BLOCK) {
+    size_t blocks = std::min(size, ADLER_NMAX) / BLOCK;
+    size -= blocks * BLOCK;
+    __m256i prev = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, s1 * blocks);
+    __m256i vs1 = zero;
+    __m256i vs2 = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, s2);
+    for (; blocks > 0; blocks--) {
+      const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+      prev = _mm256_add_epi32(prev, vs1);
+      vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(bytes, zero));
+      vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+      data += BLOCK;
     }
-    return (s2 << 16) | s1;
+    vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(prev, 5));
+    s1 = (s1 + hsum32(vs1)) % ADLER_BASE;
+    s2 = hsum32(vs2) % ADLER_BASE;
+  }
+  return adler32Scalar(data, size, s1, s2);
 }
+#endif
 
-std::string normalize_link(const std::string& input, const std::string& baseUrl)
+uint32_t adler32Portable(const unsigned char* data, size_t size)
 {
-    std::string output;
-    output.reserve(baseUrl.size() + input.size() + 1);
+  return adler32Scalar(data, size, 1, 0);
+}
+
+typedef uint32_t (*Adler32Function)(const unsigned char* data, size_t size);
+
+Adler32Function selectAdler32()
+{
+#ifdef ADLER32_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return adler32Avx2;
+  }
+#endif
+  return adler32Portable;
+}
+
+} // unnamed namespace
+
+uint32_t adler32(const char* data, size_t size)
+{
+  static const Adler32Function implementation = selectAdler32();
+  return implementation(reinterpret_cast<const unsigned char*>(data), size);
+}
+
+namespace
+{
+
+// Mixing functions of wyhash (public domain): the 128 bits product of the
+// two operands, folded in 64 bits.
+const uint64_t HASH_SECRET[4] = {
+  0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+inline void multiply128(uint64_t& a, uint64_t& b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = a;
+  r *= b;
+  a = uint64_t(r);
+  b = uint64_t(r >> 64);
+#else
+  const uint64_t ha = a >> 32, hb = b >> 32, la = uint32_t(a), lb = uint32_t(b);
+  const uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+  const uint64_t t = ll + (hl << 32);
+  const uint64_t low = t + (lh << 32);
+  const uint64_t high = hh + (hl >> 32) + (lh >> 32) + (t < ll) + (low < t);
+  a = low;
+  b = high;
+#endif
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b)
+{
+  multiply128(a, b);
+  return a ^ b;
+}
+
+// The hash doesn't have to be the same on all platforms (it is never
+// stored), so the words are read in the native byte order.
+inline uint64_t read64(const unsigned char* p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+inline uint64_t read32(const unsigned char* p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+} // unnamed namespace
+
+uint64_t contentHash64(const char* data, size_t size, uint64_t seed)
+{
+  const auto p = reinterpret_cast<const unsigned char*>(data);
+  const auto s = HASH_SECRET;
+  seed ^= mix(seed ^ s[0], s[1]);
+  uint64_t a, b;
+  if (size <= 16) {
+    if (size >= 4) {
+      const size_t middle = (size >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + middle);
+      b = (read32(p + size - 4) << 32) | read32(p + size - 4 - middle);
+    } else if (size > 0) {
+      a = (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) | p[size - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    const unsigned char* q = p;
+    size_t left = size;
+    if (left > 48) {
+      // Three independent lanes, to keep several multiplications in flight.
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = mix(read64(q) ^ s[1], read64(q + 8) ^ seed);
+        seed1 = mix(read64(q + 16) ^ s[2], read64(q + 24) ^ seed1);
+        seed2 = mix(read64(q + 32) ^ s[3], read64(q + 40) ^ seed2);
+        q += 48;
+        left -= 48;
+      } while (left > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (left > 16) {
+      seed = mix(read64(q) ^ s[1], read64(q + 8) ^ seed);
+      q += 16;
+      left -= 16;
+    }
+    a = read64(q + left - 16);
+    b = read64(q + left - 8);
+  }
+  a ^= s[1];
+  b ^= seed;
+  multiply128(a, b);
+  return mix(a ^ s[0] ^ size, b ^ s[1]);
+}
+
+ContentHash contentHash128(const char* data, size_t size)
+{
+  // Two hashes with independent seeds. For the usual sizes of the items,
+  // the second pass reads the data from the cache.
+  ContentHash hash;
+  hash.low = contentHash64(data, size, 0);
+  hash.high = contentHash64(data, size, 0x9e3779b97f4a7c15ULL);
+  return hash;
+}
+
+namespace
+{
+
+const uint32_t md5_sines[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+const unsigned int md5_shifts[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+inline uint32_t rotateLeft(uint32_t x, unsigned int n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+} // unnamed namespace
+
+Md5Hasher::Md5Hasher()
+  : state{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476},
+    length(0),
+    buffered(0)
+{}
+
+void Md5Hasher::transform(const unsigned char* block)
+{
+  uint32_t m[16];
+  for (unsigned int i = 0; i < 16; ++i) {
+    m[i] = uint32_t(block[i*4])
+         | (uint32_t(block[i*4+1]) << 8)
+         | (uint32_t(block[i*4+2]) << 16)
+         | (uint32_t(block[i*4+3]) << 24);
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  for (unsigned int i = 0; i < 64; ++i) {
+    uint32_t f;
+    unsigned int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5*i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3*i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7*i) % 16;
+    }
+    const uint32_t tmp = d;
+    d = c;
+    c = b;
+    b = b + rotateLeft(a + f + md5_sines[i] + m[g], md5_shifts[i]);
+    a = tmp;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+void Md5Hasher::update(const char* data, size_t size)
+{
+  auto bytes = reinterpret_cast<const unsigned char*>(data);
+  length += size;
+  if (buffered) {
+    const size_t toCopy = std::min(size, sizeof(buffer) - buffered);
+    memcpy(buffer + buffered, bytes, toCopy);
+    buffered += toCopy;
+    bytes += toCopy;
+    size -= toCopy;
+    if (buffered < sizeof(buffer)) {
+      return;
+    }
+    transform(buffer);
+    buffered = 0;
+  }
+  while (size >= sizeof(buffer)) {
+    transform(bytes);
+    bytes += sizeof(buffer);
+    size -= sizeof(buffer);
+  }
+  memcpy(buffer, bytes, size);
+  buffered = size;
+}
+
+std::string Md5Hasher::hexDigest()
+{
+  const uint64_t bitLength = length * 8;
+  unsigned char padding[72] = { 0x80 };
+  const size_t paddingSize = (buffered < 56 ? 56 : 120) - buffered;
+  for (unsigned int i = 0; i < 8; ++i) {
+    padding[paddingSize + i] = static_cast<unsigned char>(bitLength >> (8*i));
+  }
+  update(reinterpret_cast<const char*>(padding), paddingSize + 8);
+
+  static const char hex[] = "0123456789abcdef";
+  std::string digest;
+  for (unsigned int i = 0; i < 16; ++i) {
+    const unsigned char byte = state[i/4] >> (8*(i%4));
+    digest += hex[byte >> 4];
+    digest += hex[byte & 0xf];
+  }
+  return digest;
+}
+
+void jsonString(const std::string& s, std::string& output)
+{
+  static const char hex[] = "0123456789abcdef";
+  output += '"';
+  for (unsigned char c: s) {
+    switch (c) {
+      case '"': output += "\\\""; break;
+      case '\\': output += "\\\\"; break;
+      case '\t': output += "\\t"; break;
+      case '\n': output += "\\n"; break;
+      case '\r': output += "\\r"; break;
+      default:
+        if (c < 0x20) {
+          output += "\\u00";
+          output += hex[c >> 4];
+          output += hex[c & 0xf];
+        } else {
+          output += c;
+        }
+    }
+  }
+  output += '"';
+}
+
+const char* compressionName(uint8_t clusterInfo)
+{
+  switch (clusterInfo & 0x0f) {
+    case 0:
+    case 1: return "none";
+    case 2: return "zip";
+    case 3: return "bzip2";
+    case 4: return "lzma";
+    case 5: return "zstd";
+    default: return "unknown";
+  }
+}
+
+namespace
+{
+
+// Delta format : the size of the target, then a list of operations.
+// All numbers are LEB128 varints.
+//   DELTA_COPY offset length : copy `length` bytes of the source from `offset`.
+//   DELTA_ADD length bytes   : insert the `length` following bytes.
+const char DELTA_COPY = 0;
+const char DELTA_ADD = 1;
+const size_t DELTA_BLOCK_SIZE = 16;
+const size_t DELTA_MIN_MATCH = 2 * DELTA_BLOCK_SIZE;
+const size_t DELTA_MAX_PROBES = 16;
+const uint64_t DELTA_HASH_BASE = 0x100000001b3ULL;
+
+void writeVarint(std::string& out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out += char((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += char(value);
+}
+
+uint64_t readVarint(const char*& p, const char* end)
+{
+  uint64_t value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    if (p == end) {
+      throw std::runtime_error("Truncated delta");
+    }
+    const unsigned char byte = *p++;
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  throw std::runtime_error("Invalid varint in delta");
+}
+
+uint64_t blockHash(const char* data)
+{
+  uint64_t hash = 0;
+  for (size_t i = 0; i < DELTA_BLOCK_SIZE; ++i) {
+    hash = hash * DELTA_HASH_BASE + static_cast<unsigned char>(data[i]);
+  }
+  return hash;
+}
+
+void writeAdd(std::string& out, const char* data, size_t size)
+{
+  if (size) {
+    out += DELTA_ADD;
+    writeVarint(out, size);
+    out.append(data, size);
+  }
+}
+
+} // unnamed namespace
+
+std::string computeDelta(const char* source, size_t sourceSize,
+                         const char* target, size_t targetSize)
+{
+  std::string delta;
+  writeVarint(delta, targetSize);
+
+  // Index the (non overlapping) blocks of the source by their hash.
+  // Blocks with the same hash slot are chained, the last one first.
+  size_t tableBits = 4;
+  while ((size_t(1) << tableBits) < sourceSize / DELTA_BLOCK_SIZE * 2) {
+    tableBits++;
+  }
+  const size_t noEntry = size_t(-1);
+  std::vector<size_t> table(size_t(1) << tableBits, noEntry);
+  std::vector<size_t> chain(sourceSize / DELTA_BLOCK_SIZE, noEntry);
+  auto slot = [&](uint64_t hash) {
+    return size_t((hash * 0x9e3779b97f4a7c15ULL) >> (64 - tableBits));
+  };
+  for (size_t offset = 0; offset + DELTA_BLOCK_SIZE <= sourceSize; offset += DELTA_BLOCK_SIZE) {
+    auto& head = table[slot(blockHash(source + offset))];
+    chain[offset / DELTA_BLOCK_SIZE] = head;
+    head = offset;
+  }
+
+  // Power of the hash base used to remove the first byte of the rolling window.
+  uint64_t removeFactor = 1;
+  for (size_t i = 1; i < DELTA_BLOCK_SIZE; ++i) {
+    removeFactor *= DELTA_HASH_BASE;
+  }
+
+  size_t pending = 0;  // Start of the bytes not yet written in the delta.
+  size_t lastSourceEnd = 0;  // End of the last copied source data.
+  size_t pos = 0;
+
+  struct Match {
+    size_t sourceStart;
+    size_t targetStart;
+    size_t length;
+  };
+  // Extend the match of the block at `pos` with the block at `candidate`
+  // in both directions (but not before `pending`).
+  auto extend = [&](size_t candidate) {
+    Match match = {candidate, pos, DELTA_BLOCK_SIZE};
+    while (match.targetStart > pending && match.sourceStart > 0
+        && target[match.targetStart-1] == source[match.sourceStart-1]) {
+      match.targetStart--;
+      match.sourceStart--;
+      match.length++;
+    }
+    while (match.targetStart + match.length < targetSize
+        && match.sourceStart + match.length < sourceSize
+        && target[match.targetStart + match.length] == source[match.sourceStart + match.length]) {
+      match.length++;
+    }
+    return match;
+  };
+
+  uint64_t hash = targetSize >= DELTA_BLOCK_SIZE ? blockHash(target) : 0;
+  while (pos + DELTA_BLOCK_SIZE <= targetSize) {
+    Match best = {0, 0, 0};
+
+    // Contents are mostly edited in place : first try to continue after the
+    // last copy.
+    const size_t next = lastSourceEnd + (pos - pending);
+    if (next + DELTA_BLOCK_SIZE <= sourceSize
+     && memcmp(source + next, target + pos, DELTA_BLOCK_SIZE) == 0) {
+      best = extend(next);
+    } else {
+      // Else look for the longest match in the source blocks with the same hash.
+      // Short matches are probably a repeated pattern at the wrong place.
+      size_t probes = DELTA_MAX_PROBES;
+      for (size_t candidate = table[slot(hash)];
+           candidate != noEntry && probes > 0;
+           candidate = chain[candidate / DELTA_BLOCK_SIZE], --probes) {
+        if (memcmp(source + candidate, target + pos, DELTA_BLOCK_SIZE) == 0) {
+          auto match = extend(candidate);
+          if (match.length > best.length) {
+            best = match;
+          }
+        }
+      }
+      if (best.length < DELTA_MIN_MATCH) {
+        best.length = 0;
+      }
+    }
+
+    if (best.length) {
+      writeAdd(delta, target + pending, best.targetStart - pending);
+      delta += DELTA_COPY;
+      writeVarint(delta, best.sourceStart);
+      writeVarint(delta, best.length);
+      pending = pos = best.targetStart + best.length;
+      lastSourceEnd = best.sourceStart + best.length;
+      if (pos + DELTA_BLOCK_SIZE <= targetSize) {
+        hash = blockHash(target + pos);
+      }
+      continue;
+    }
+
+    if (pos + DELTA_BLOCK_SIZE < targetSize) {
+      hash = (hash - removeFactor * static_cast<unsigned char>(target[pos])) * DELTA_HASH_BASE
+           + static_cast<unsigned char>(target[pos + DELTA_BLOCK_SIZE]);
+    }
+    pos++;
+  }
+  writeAdd(delta, target + pending, targetSize - pending);
+  return delta;
+}
+
+std::string applyDelta(const char* source, size_t sourceSize,
+                       const char* delta, size_t deltaSize)
+{
+  const char* p = delta;
+  const char* const end = delta + deltaSize;
+  const uint64_t targetSize = readVarint(p, end);
+
+  // Don't trust the size before allocating: each operation takes at least
+  // 3 bytes of delta and a copy produces at most `sourceSize` bytes.
+  const uint64_t remaining = end - p;
+  const uint64_t maxCopies = remaining / 3;
+  uint64_t maxTargetSize = UINT64_MAX;
+  if (sourceSize == 0 || maxCopies <= (UINT64_MAX - remaining) / sourceSize) {
+    maxTargetSize = maxCopies * sourceSize + remaining;
+  }
+  if (targetSize > maxTargetSize) {
+    throw std::runtime_error("Invalid target size in delta");
+  }
+
+  std::string target;
+  // Most deltas copy each part of the source once.
+  target.reserve(std::min<uint64_t>(targetSize, sourceSize + remaining));
+  while (p != end) {
+    const char op = *p++;
+    if (op == DELTA_COPY) {
+      const uint64_t offset = readVarint(p, end);
+      const uint64_t length = readVarint(p, end);
+      if (offset > sourceSize || length > sourceSize - offset) {
+        throw std::runtime_error("Delta copies data out of the source");
+      }
+      target.append(source + offset, length);
+    } else if (op == DELTA_ADD) {
+      const uint64_t length = readVarint(p, end);
+      if (length > uint64_t(end - p)) {
+        throw std::runtime_error("Truncated delta");
+      }
+      target.append(p, length);
+      p += length;
+    } else {
+      throw std::runtime_error("Invalid operation in delta");
+    }
+    if (target.size() > targetSize) {
+      throw std::runtime_error("Delta produces too much data");
+    }
+  }
+  if (target.size() != targetSize) {
+    throw std::runtime_error("Delta produces too few data");
+  }
+  return target;
+}
+
+namespace
+{
+
+const char BITSET_MAGIC[] = "\0ZB1";
+const char REDIRECTLIST_MAGIC[] = "\0ZR1";
+const size_t MAGIC_SIZE = 4;
+
+bool hasMagic(const char* data, size_t size, const char* magic)
+{
+  return size >= MAGIC_SIZE && memcmp(data, magic, MAGIC_SIZE) == 0;
+}
+
+} // unnamed namespace
+
+Bitset::Bitset(size_t size)
+  : count(size),
+    bits((size + 7) / 8, 0)
+{}
+
+bool Bitset::isEncoded(const char* data, size_t size)
+{
+  return hasMagic(data, size, BITSET_MAGIC);
+}
+
+Bitset Bitset::decode(const char* data, size_t size)
+{
+  if (!isEncoded(data, size)) {
+    throw std::runtime_error("Invalid bitset");
+  }
+  const char* p = data + MAGIC_SIZE;
+  const char* const end = data + size;
+  const uint64_t count = readVarint(p, end);
+  if (count > uint64_t(end - p) * 8 || (count + 7) / 8 != uint64_t(end - p)) {
+    throw std::runtime_error("Invalid bitset size");
+  }
+  Bitset bitset(count);
+  std::copy(p, end, bitset.bits.begin());
+  return bitset;
+}
+
+std::string Bitset::encode() const
+{
+  std::string out(BITSET_MAGIC, MAGIC_SIZE);
+  writeVarint(out, count);
+  out.append(bits.begin(), bits.end());
+  return out;
+}
+
+RedirectListWriter::RedirectListWriter()
+  : buffer(REDIRECTLIST_MAGIC, MAGIC_SIZE),
+    lastIndex(0)
+{}
+
+void RedirectListWriter::add(uint32_t index, const std::string& target)
+{
+  if (buffer.size() > MAGIC_SIZE && index <= lastIndex) {
+    throw std::logic_error("Redirects must be added in increasing index order");
+  }
+  // Store the difference with the previous index, which is small.
+  writeVarint(buffer, buffer.size() > MAGIC_SIZE ? index - lastIndex : index);
+  writeVarint(buffer, target.size());
+  buffer += target;
+  lastIndex = index;
+}
+
+bool RedirectListReader::isEncoded(const char* data, size_t size)
+{
+  return hasMagic(data, size, REDIRECTLIST_MAGIC);
+}
+
+RedirectListReader::RedirectListReader(const char* data, size_t size)
+  : current(data + MAGIC_SIZE),
+    end(data + size),
+    started(false),
+    atEnd(false),
+    currentIndex(0)
+{
+  if (!isEncoded(data, size)) {
+    throw std::runtime_error("Invalid redirect list");
+  }
+}
+
+bool RedirectListReader::next()
+{
+  if (current == end) {
+    atEnd = true;
+    return false;
+  }
+  const auto indexDelta = readVarint(current, end);
+  currentIndex = started ? currentIndex + indexDelta : indexDelta;
+  started = true;
+  const auto targetSize = readVarint(current, end);
+  if (targetSize > uint64_t(end - current)) {
+    throw std::runtime_error("Truncated redirect list");
+  }
+  currentTarget.assign(current, targetSize);
+  current += targetSize;
+  return true;
+}
+
+bool RedirectListReader::seek(uint32_t index)
+{
+  if (!started && !next()) {
+    return false;
+  }
+  while (!atEnd && currentIndex < index) {
+    next();
+  }
+  return !atEnd && currentIndex == index;
+}
+
+namespace
+{
+
+bool isQuote(char c)
+{
+  return c == '\'' || c == '"';
+}
+
+// Characters which can't be part of a link path segment.
+bool endsLinkSegment(char c)
+{
+  switch (c) {
+    case '\'': case '"': case '/': case '?': case '#':
+    case ' ': case '\t': case '\n': case '\r': case '<': case '>':
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isOldNamespace(const char* segment, size_t size)
+{
+  return size == 1
+      && (segment[0] == 'A' || segment[0] == 'I' || segment[0] == 'J' || segment[0] == '-');
+}
+
+// Match "../" (k times, mixed with cancelled segments) followed by a
+// namespace and a "/" at `p`. Return the end of the match (or nullptr) and
+// set the number of "../" in `upLevels`.
+const char* matchNamespaceLink(const char* p, const char* end, size_t& upLevels)
+{
+  upLevels = 0;
+  size_t pendingSegments = 0;
+  while (p < end) {
+    const char* segmentEnd = p;
+    while (segmentEnd < end && !endsLinkSegment(*segmentEnd)) {
+      segmentEnd++;
+    }
+    if (segmentEnd == end || *segmentEnd != '/' || segmentEnd == p) {
+      return nullptr;
+    }
+    const size_t size = segmentEnd - p;
+    if (size == 2 && p[0] == '.' && p[1] == '.') {
+      if (pendingSegments) {
+        pendingSegments--;
+      } else {
+        upLevels++;
+      }
+    } else if (upLevels == 0) {
+      // A link to remove must start with "../"
+      return nullptr;
+    } else if (pendingSegments == 0 && isOldNamespace(p, size)) {
+      return segmentEnd + 1;
+    } else {
+      pendingSegments++;
+    }
+    p = segmentEnd + 1;
+  }
+  return nullptr;
+}
+
+} // unnamed namespace
+
+std::string removeLinksNamespace(const std::string& content)
+{
+  std::string output;
+  output.reserve(content.size());
+
+  const char* const begin = content.data();
+  const char* const end = begin + content.size();
+  const char* copied = begin;  // Start of the content not yet copied to output.
+  const char* p = begin;
+  while (p < end) {
+    if (!isQuote(*p)) {
+      p++;
+      continue;
+    }
+    size_t upLevels;
+    const char* matchEnd = matchNamespaceLink(p + 1, end, upLevels);
+    if (!matchEnd) {
+      p++;
+      continue;
+    }
+    output.append(copied, p + 1 - copied);
+    for (size_t i = 1; i < upLevels; i++) {
+      output.append("../", 3);
+    }
+    copied = p = matchEnd;
+  }
+  output.append(copied, end - copied);
+  return output;
+}
+
+bool normalizeLink(const char* link, size_t linkSize,
+                   const char* base, size_t baseSize,
+                   std::string& output)
+{
+    output.clear();
+    const char* p = link;
+    const char* const end = link + linkSize;
 
-    bool in_query = false;
     bool check_rel = false;
-    const char* p = input.c_str();
-    if ( *(p) == '/') {
+    if (p < end && *p == '/') {
       // This is an absolute url.
       p++;
     } else {
       //This is a relative url, use base url
-      output = baseUrl;
-      if (output.back() != '/')
+      output.append(base, baseSize);
+      if (output.empty() || output.back() != '/')
           output += '/';
       check_rel = true;
     }
 
-    //URL Decoding.
-    while (*p)
+    while (p < end)
     {
-        if ( !in_query && check_rel ) {
-            if (strncmp(p, "../", 3) == 0) {
+        if (check_rel) {
+            if (end - p >= 3 && p[0] == '.' && p[1] == '.' && p[2] == '/') {
                 // We must go "up"
+                if (output.size() <= 1) {
+                    // Already at the root ("" or "/").
+                    return false;
+                }
                 // Remove the '/' at the end of output.
                 output.resize(output.size()-1);
                 // Remove the last part.
@@ -325,7 +1133,7 @@ std::string normalize_link(const std::string& input, const std::string& baseUrl)
                 check_rel = false;
                 continue;
             }
-            if (strncmp(p, "./", 2) == 0) {
+            if (end - p >= 2 && p[0] == '.' && p[1] == '/') {
                 // We must simply skip this part
                 // Simply move after the ".".
                 p += 2;
@@ -333,21 +1141,28 @@ std::string normalize_link(const std::string& input, const std::string& baseUrl)
                 continue;
             }
         }
+        const char* run = p;
+        while (run < end && *run != '/' && *run != '%' && *run != '#' && *run != '?') {
+            run++;
+        }
+        if (run > p) {
+            output.append(p, run - p);
+            p = run;
+            check_rel = false;
+            continue;
+        }
         if ( *p == '#' || *p == '?')
-            // This is a beginning of the #anchor inside a page. No need to decode more
+            // This is a beginning of the #anchor or ?query. No need to decode more
             break;
-        if ( *p == '%')
+        char ch;
+        if ( *p == '%' && decodeHex(p, end, ch))
         {
-            char ch;
-            sscanf(p+1, "%2hhx", &ch);
             output += ch;
             p += 3;
+            check_rel = false;
             continue;
         }
-        if ( *p == '?' ) {
-            // We are in the query, so don't try to interprete '/' as path separator
-            in_query = true;
-        }
+        check_rel = false;
         if ( *p == '/') {
             check_rel = true;
             if (output.empty()) {
@@ -358,6 +1173,13 @@ std::string normalize_link(const std::string& input, const std::string& baseUrl)
         }
         output += *(p++);
     }
+    return true;
+}
+
+std::string normalize_link(const std::string& input, const std::string& baseUrl)
+{
+    std::string output;
+    normalizeLink(input.data(), input.size(), baseUrl.data(), baseUrl.size(), output);
     return output;
 }
 
@@ -23,6 +23,7 @@
 
 #include <map>
 #include <string>
+#include <cstdint>
 #include <vector>
 #include <stdexcept>
 #include <sstream>
@@ -161,6 +162,8 @@ class CopyItem : public zim::writer::Item         //Article class that will be p
 std::string getMimeTypeForFile(const std::string& basedir, const std::string& filename);
 std::string getFileContent(const std::string& path);
 std::string decodeUrl(const std::string& encodedUrl);
+// Same as above, in `output` (whose capacity is reused).
+void decodeUrl(const char* data, size_t size, std::string& output);
 std::string computeAbsolutePath(const std::string& path,
                                 const std::string& relativePath);
 bool fileExists(const std::string& path);
@@ -180,15 +183,168 @@ void stripTitleInvalidChars(std::string& str);
 //Returns a vector of the links in a particular page. includes links under 'href' and 'src'
 std::vector<html_link> generic_getLinks(const std::string& page);
 
-// checks if a relative path is out of bounds (relative to base)
-bool isOutofBounds(const std::string& input, std::string base);
+// checks if a relative path is out of bounds (relative to base):
+// it goes above the root once resolved (see normalizeLink).
+bool isOutofBounds(const std::string& input, const std::string& base);
 
-//Adler32 Hash Function. Used to hash the BLOB data obtained from each article, for redundancy checks.
-//Please note that the adler32 hash function has a high number of collisions, and that the hash match is not taken as final.
-int adler32(const std::string& buf);
+// Adler32 checksum (as in zlib) of the data.
+// Uses AVX2 when the cpu supports it.
+uint32_t adler32(const char* data, size_t size);
+inline uint32_t adler32(const std::string& buf) { return adler32(buf.data(), buf.size()); }
+
+// Fast non cryptographic hashes of a content, to find the identical
+// contents (redundant articles, unchanged items).
+// The values may change between platforms and versions: don't store them.
+uint64_t contentHash64(const char* data, size_t size, uint64_t seed = 0);
+
+struct ContentHash
+{
+  uint64_t low;
+  uint64_t high;
+
+  bool operator==(const ContentHash& other) const { return low == other.low && high == other.high; }
+  bool operator!=(const ContentHash& other) const { return !(*this == other); }
+};
+ContentHash contentHash128(const char* data, size_t size);
+
+// Incremental MD5 hasher.
+// Used to checksum data while it is copied (zimsplit manifest).
+class Md5Hasher
+{
+  public:
+    Md5Hasher();
+
+    void update(const char* data, size_t size);
+
+    // Finalize the hash and return it as a lowercase hexadecimal string.
+    // The hasher must not be updated afterwards.
+    std::string hexDigest();
+
+  private:
+    void transform(const unsigned char* block);
+
+    uint32_t state[4];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t buffered;
+};
+
+// Append `s` to `output` as a quoted JSON string.
+void jsonString(const std::string& s, std::string& output);
+inline std::string jsonString(const std::string& s)
+{
+  std::string output;
+  jsonString(s, output);
+  return output;
+}
+
+// Name of the compression of a cluster, from its info byte.
+const char* compressionName(uint8_t clusterInfo);
+
+// Binary delta between two versions of a content (used by zimdiff and zimpatch).
+// The delta is made of copies of blocks from the source and of inserted data.
+std::string computeDelta(const char* source, size_t sourceSize,
+                         const char* target, size_t targetSize);
+
+// Rebuild the target content from the source and a delta made by computeDelta.
+// Throw a std::runtime_error if the delta is invalid.
+std::string applyDelta(const char* source, size_t sourceSize,
+                       const char* delta, size_t deltaSize);
+
+// Compact binary encodings of the lists stored in the metadata of a diff file.
+// They refer to the entries of the start file by their index (in path order).
+// Each encoding starts with a magic string which cannot start a path, to make
+// the difference with the old newline separated lists of paths.
+
+// Set of entries (or clusters) of an archive.
+// The entries are indexed up to getAllEntryCount(), as entry.getIndex().
+class Bitset
+{
+  public:
+    explicit Bitset(size_t size = 0);
+
+    // Throw a std::runtime_error if the data is not an encoded bitset.
+    static Bitset decode(const char* data, size_t size);
+    static bool isEncoded(const char* data, size_t size);
+
+    // Throw a std::out_of_range if the index is not less than size().
+    void set(size_t index) {
+      if (index >= count) {
+        throw std::out_of_range("Bitset index out of range");
+      }
+      bits[index/8] |= 1 << (index%8);
+    }
+    // The indexes out of range are not in the set.
+    bool test(size_t index) const {
+      return index < count && (bits[index/8] >> (index%8)) & 1;
+    }
+    size_t size() const { return count; }
+    std::string encode() const;
+
+  private:
+    size_t count;
+    std::vector<unsigned char> bits;
+};
+
+// List of (entry index, redirect target path), added in increasing index order.
+class RedirectListWriter
+{
+  public:
+    RedirectListWriter();
+
+    void add(uint32_t index, const std::string& target);
+    const std::string& data() const { return buffer; }
+
+  private:
+    std::string buffer;
+    uint32_t lastIndex;
+};
+
+// Read a list written by RedirectListWriter, in increasing index order.
+// The data must outlive the reader.
+class RedirectListReader
+{
+  public:
+    // Throw a std::runtime_error if the data is not an encoded redirect list.
+    RedirectListReader(const char* data, size_t size);
+    static bool isEncoded(const char* data, size_t size);
+
+    // Go to the next redirect. Return false at the end of the list.
+    bool next();
+    uint32_t index() const { return currentIndex; }
+    const std::string& target() const { return currentTarget; }
+
+    // Go to the first redirect whose index is greater or equal to `index`
+    // and return true if it is `index`.
+    bool seek(uint32_t index);
+
+  private:
+    const char* current;
+    const char* end;
+    bool started;
+    bool atEnd;
+    uint32_t currentIndex;
+    std::string currentTarget;
+};
+
+// Remove the namespace from the relative links of a html/css content of an
+// old namespace scheme archive, in one pass: a link starting with a quote,
+// k times "../" and a namespace ("A/", "I/", "J/" or "-/") now starts with
+// k-1 times "../". Path segments cancelled by a ".." before the namespace
+// (`'../foo/../I/img.png'`) are handled too.
+std::string removeLinksNamespace(const std::string& content);
 
 //Removes extra spaces from URLs. Usually done by the browser, so web authors sometimes tend to ignore it.
 //Converts the %20 to space.Essential for comparing URLs.
 std::string normalize_link(const std::string& input, const std::string& baseUrl);
 
+// Same as above, in `output`. It doesn't allocate once the capacity of
+// `output` is large enough, so the same buffer should be used for all the
+// links of a page.
+// Return false (and an unspecified output) if the link is out of bounds: a
+// relative link with more ".." than the depth of `base`.
+bool normalizeLink(const char* link, size_t linkSize,
+                   const char* base, size_t baseSize,
+                   std::string& output);
+
 #endif  // OPENZIM_TOOLS_H
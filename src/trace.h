@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2026 Matthieu Gautier <mgautier@kymeria.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENZIM_TRACE_H
+#define OPENZIM_TRACE_H
+
+/* Instrumentation of the hot paths of the tools:
+ *
+ *   ZIM_TRACE_SCOPE("name");          // Time the end of the enclosing block.
+ *   ZIM_TRACE_COUNT("name", value);   // Add value to a counter.
+ *
+ * The macros are no-ops unless the tools are built with the `tracing`
+ * meson option (which defines ZIM_TOOLS_TRACING). The names must be string
+ * literals. When built in, the tracing is enabled at run time by the
+ * environment:
+ *
+ *   ZIM_TOOLS_TRACE=file.json   Write the events in the Chrome trace event
+ *                               format (chrome://tracing, Perfetto), and a
+ *                               summary of each scope and counter on stderr.
+ *   ZIM_TOOLS_TRACE_MARKERS=1   (Linux) Write the begin and end of the scopes
+ *                               in the ftrace marker file, to be seen by
+ *                               `perf trace` or `trace-cmd`.
+ */
+
+#ifdef ZIM_TOOLS_TRACING
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace trace
+{
+
+struct Event
+{
+  const char* name;
+  int64_t start;     // ns since the start of the tracer.
+  int64_t value;     // Duration in ns of a scope, or increment of a counter.
+  unsigned thread;
+  bool counter;
+};
+
+class Tracer
+{
+  public:
+    static Tracer& instance()
+    {
+      static Tracer tracer;
+      return tracer;
+    }
+
+    bool enabled() const { return m_enabled; }
+    bool markers() const { return m_markerFd >= 0; }
+
+    int64_t now() const
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    unsigned newThread() { return m_threadCount++; }
+
+    // Write a batch of events in the trace and add them to the summary.
+    void add(std::vector<Event>& events);
+
+    void marker(char kind, const char* name)
+    {
+#ifdef __linux__
+      char buffer[256];
+      int size = snprintf(buffer, sizeof(buffer), "%c|%d|%s\n", kind, int(getpid()), name);
+      if (size > 0 && write(m_markerFd, buffer, std::min<size_t>(size, sizeof(buffer) - 1)) < 0) {
+        // Nothing to do, the marker is lost.
+      }
+#endif
+    }
+
+    ~Tracer();
+
+  private:
+    // Distribution of the durations of a scope: exact count, total and max,
+    // and a log-linear histogram (16 buckets per power of 2) for the
+    // percentiles.
+    struct Durations
+    {
+      static const unsigned SUB_BITS = 4;
+
+      uint64_t count = 0;
+      uint64_t total = 0;
+      uint64_t max = 0;
+      std::vector<uint64_t> buckets;
+
+      static size_t bucket(uint64_t value)
+      {
+        if (value < (1U << SUB_BITS)) {
+          return size_t(value);
+        }
+        unsigned msb = 63;
+        while (!(value >> msb)) {
+          msb--;
+        }
+        return size_t((msb - SUB_BITS + 1) << SUB_BITS)
+             + size_t((value >> (msb - SUB_BITS)) - (1U << SUB_BITS));
+      }
+
+      // Upper bound of the values of a bucket.
+      static uint64_t bucketMax(size_t index)
+      {
+        if (index < (1U << SUB_BITS)) {
+          return index;
+        }
+        const unsigned shift = unsigned(index >> SUB_BITS) - 1;
+        const uint64_t base = (uint64_t(1) << SUB_BITS) + (index & ((1U << SUB_BITS) - 1));
+        return ((base + 1) << shift) - 1;
+      }
+
+      void add(uint64_t value)
+      {
+        count++;
+        total += value;
+        max = std::max(max, value);
+        const auto index = bucket(value);
+        if (buckets.size() <= index) {
+          buckets.resize(index + 1, 0);
+        }
+        buckets[index]++;
+      }
+
+      uint64_t percentile(double p) const
+      {
+        const uint64_t rank = uint64_t(p * (count - 1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets.size(); i++) {
+          seen += buckets[i];
+          if (seen > rank) {
+            return std::min(bucketMax(i), max);
+          }
+        }
+        return max;
+      }
+    };
+
+    // The names are string literals: compare their content, not their address.
+    struct NameLess
+    {
+      bool operator()(const char* a, const char* b) const { return strcmp(a, b) < 0; }
+    };
+
+    Tracer()
+      : m_enabled(false),
+        m_markerFd(-1),
+        m_threadCount(0),
+        m_start(std::chrono::steady_clock::now()),
+        m_out(nullptr),
+        m_separator("\n")
+    {
+      const char* path = getenv("ZIM_TOOLS_TRACE");
+      if (path && *path) {
+        m_path = path;
+        m_enabled = true;
+        m_out = fopen(path, "w");
+        if (m_out) {
+          fprintf(m_out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+        } else {
+          fprintf(stderr, "Impossible to write the trace in %s\n", path);
+        }
+      }
+#ifdef __linux__
+      const char* markers = getenv("ZIM_TOOLS_TRACE_MARKERS");
+      if (markers && *markers && strcmp(markers, "0") != 0) {
+        m_markerFd = open("/sys/kernel/tracing/trace_marker", O_WRONLY);
+        if (m_markerFd < 0) {
+          m_markerFd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY);
+        }
+      }
+#endif
+    }
+
+    void writeSummary() const;
+
+    bool m_enabled;
+    int m_markerFd;
+    std::string m_path;
+    std::atomic<unsigned> m_threadCount;
+    std::chrono::steady_clock::time_point m_start;
+    // The events are written in the trace as they come, by batch, and only
+    // their summary is kept: the trace of a long run doesn't fit in memory.
+    std::mutex m_mutex;
+    FILE* m_out;
+    const char* m_separator;
+    std::map<const char*, Durations, NameLess> m_scopes;
+    std::map<const char*, int64_t, NameLess> m_counters;
+};
+
+// The events of a thread, given to the tracer when the thread ends (or
+// when there are many of them).
+class ThreadEvents
+{
+  public:
+    static ThreadEvents& instance()
+    {
+      static thread_local ThreadEvents events;
+      return events;
+    }
+
+    void add(const char* name, int64_t start, int64_t value, bool counter)
+    {
+      Event event = {name, start, value, m_thread, counter};
+      m_events.push_back(event);
+      if (m_events.size() >= FLUSH_SIZE) {
+        m_tracer.add(m_events);
+      }
+    }
+
+    ~ThreadEvents() { m_tracer.add(m_events); }
+
+  private:
+    static const size_t FLUSH_SIZE = 1 << 16;
+
+    ThreadEvents()
+      : m_tracer(Tracer::instance()),
+        m_thread(m_tracer.newThread())
+    {}
+
+    Tracer& m_tracer;
+    unsigned m_thread;
+    std::vector<Event> m_events;
+};
+
+class Scope
+{
+  public:
+    explicit Scope(const char* name)
+      : m_name(name),
+        m_start(-1)
+    {
+      auto& tracer = Tracer::instance();
+      if (tracer.markers()) {
+        tracer.marker('B', name);
+      }
+      if (tracer.enabled()) {
+        m_start = tracer.now();
+      }
+    }
+
+    ~Scope()
+    {
+      auto& tracer = Tracer::instance();
+      if (m_start >= 0) {
+        ThreadEvents::instance().add(m_name, m_start, tracer.now() - m_start, false);
+      }
+      if (tracer.markers()) {
+        tracer.marker('E', m_name);
+      }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    const char* m_name;
+    int64_t m_start;
+};
+
+inline void count(const char* name, int64_t value)
+{
+  auto& tracer = Tracer::instance();
+  if (tracer.enabled()) {
+    ThreadEvents::instance().add(name, tracer.now(), value, true);
+  }
+}
+
+inline void writeJsonName(FILE* out, const char* name)
+{
+  for (const char* c = name; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', out);
+    }
+    fputc(*c, out);
+  }
+}
+
+inline void Tracer::add(std::vector<Event>& events)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto& event: events) {
+    if (event.counter) {
+      // The value of a counter is its total so far, in the order of the batches.
+      auto& total = m_counters[event.name];
+      total += event.value;
+      if (m_out) {
+        fprintf(m_out, "%s{\"name\": \"", m_separator);
+        writeJsonName(m_out, event.name);
+        fprintf(m_out, "\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 0, \"tid\": %u, \"args\": {\"value\": %lld}}",
+                event.start / 1000.0, event.thread, (long long)total);
+      }
+    } else {
+      m_scopes[event.name].add(uint64_t(event.value));
+      if (m_out) {
+        fprintf(m_out, "%s{\"name\": \"", m_separator);
+        writeJsonName(m_out, event.name);
+        fprintf(m_out, "\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 0, \"tid\": %u}",
+                event.start / 1000.0, event.value / 1000.0, event.thread);
+      }
+    }
+    m_separator = ",\n";
+  }
+  events.clear();
+}
+
+inline Tracer::~Tracer()
+{
+  if (m_enabled) {
+    // The ThreadEvents of the threads, including the main thread, are
+    // destroyed before the tracer: all the events have been added.
+    if (m_out) {
+      fprintf(m_out, "\n]}\n");
+      fclose(m_out);
+    }
+    writeSummary();
+  }
+#ifdef __linux__
+  if (m_markerFd >= 0) {
+    close(m_markerFd);
+  }
+#endif
+}
+
+inline void Tracer::writeSummary() const
+{
+  fprintf(stderr, "\n%-32s %10s %12s %10s %10s %10s %10s\n",
+          "scope", "count", "total (ms)", "mean (us)", "p50 (us)", "p99 (us)", "max (us)");
+  for (auto& scope: m_scopes) {
+    auto& durations = scope.second;
+    fprintf(stderr, "%-32s %10llu %12.3f %10.3f %10.3f %10.3f %10.3f\n",
+            scope.first, (unsigned long long)durations.count, durations.total / 1e6,
+            double(durations.total) / durations.count / 1000,
+            durations.percentile(0.5) / 1000.0, durations.percentile(0.99) / 1000.0,
+            durations.max / 1000.0);
+  }
+  for (auto& counter: m_counters) {
+    fprintf(stderr, "%-32s %10lld\n", counter.first, (long long)counter.second);
+  }
+}
+
+} // namespace trace
+
+#define ZIM_TRACE_CONCAT_(a, b) a##b
+#define ZIM_TRACE_CONCAT(a, b) ZIM_TRACE_CONCAT_(a, b)
+#define ZIM_TRACE_SCOPE(name) trace::Scope ZIM_TRACE_CONCAT(zimTraceScope, __LINE__)(name)
+#define ZIM_TRACE_COUNT(name, value) trace::count(name, value)
+
+#else
+
+#define ZIM_TRACE_SCOPE(name) do {} while (0)
+#define ZIM_TRACE_COUNT(name, value) do {} while (0)
+
+#endif // ZIM_TOOLS_TRACING
+
+#endif // OPENZIM_TRACE_H
@@ -17,29 +17,782 @@
  * MA 02110-1301, USA.
  */
 
+#define ZIM_PRIVATE
+
 #include <iostream>
+#include <iomanip>
 #include <vector>
 #include <set>
+#include <map>
 #include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <fstream>
+#include <stdexcept>
+#include <cmath>
+#include <sstream>
+#include <cstring>
 
 #include <stdlib.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 
 #include <zim/archive.h>
 #include <zim/entry.h>
 #include <zim/item.h>
 #include <zim/blob.h>
+#ifdef LIBZIM_WITH_XAPIAN
+#include <zim/search.h>
+#endif
 
 #include <getopt.h>
 
+#include "tools.h"
 #include "version.h"
 
-std::string randomUrl()
+// How the paths of the random access are drawn.
+struct Workload
+{
+  enum Kind { UNIFORM, ZIPF, REPLAY };
+  Kind kind = UNIFORM;
+  double skew = 1.0;     // Exponent of the Zipf distribution.
+  std::string logFile;   // Access log to replay.
+};
+
+// "uniform", "zipf", "zipf:SKEW" or "replay:FILE".
+bool parseWorkload(const std::string& value, Workload& workload)
+{
+  auto sep = value.find(':');
+  auto kind = value.substr(0, sep);
+  auto arg = sep == std::string::npos ? std::string() : value.substr(sep + 1);
+  if (kind == "uniform" && sep == std::string::npos) {
+    workload.kind = Workload::UNIFORM;
+  } else if (kind == "zipf") {
+    workload.kind = Workload::ZIPF;
+    if (!arg.empty()) {
+      char* end;
+      workload.skew = strtod(arg.c_str(), &end);
+      if (*end != '\0' || workload.skew < 0) {
+        return false;
+      }
+    }
+  } else if (kind == "replay" && !arg.empty()) {
+    workload.kind = Workload::REPLAY;
+    workload.logFile = arg;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// The paths of `distinct` articles (or redirects) picked uniformly among
+// the entries of the archive, in a random order.
+std::vector<std::string> pickEntries(const zim::Archive& archive, size_t distinct, std::mt19937_64& rng,
+                                     bool redirects = false)
+{
+  std::vector<zim::entry_index_type> indexes(archive.getEntryCount());
+  for (zim::entry_index_type i = 0; i < indexes.size(); i++) {
+    indexes[i] = i;
+  }
+  // Partial Fisher-Yates shuffle, stopped when enough entries are found.
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < indexes.size() && paths.size() < distinct; i++) {
+    std::uniform_int_distribution<size_t> dist(i, indexes.size() - 1);
+    std::swap(indexes[i], indexes[dist(rng)]);
+    auto entry = archive.getEntryByPath(indexes[i]);
+    if (entry.isRedirect() == redirects) {
+      paths.push_back(entry.getPath());
+    }
+  }
+  return paths;
+}
+
+// Draw `count` requests among `paths`, the path of rank k (from 0) being
+// drawn with a probability proportional to 1/(k+1)^skew.
+// A skew of 0 is the uniform distribution.
+std::vector<std::string> drawRequests(const std::vector<std::string>& paths, size_t count,
+                                      double skew, std::mt19937_64& rng)
+{
+  std::vector<std::string> requests;
+  if (paths.empty()) {
+    return requests;
+  }
+  std::vector<double> cdf(paths.size());
+  double sum = 0;
+  for (size_t k = 0; k < paths.size(); k++) {
+    sum += skew == 0 ? 1 : 1 / pow(k + 1, skew);
+    cdf[k] = sum;
+  }
+  std::uniform_real_distribution<double> dist(0, sum);
+  for (size_t r = 0; r < count; r++) {
+    auto k = std::upper_bound(cdf.begin(), cdf.end(), dist(rng)) - cdf.begin();
+    requests.push_back(paths[std::min<size_t>(k, paths.size() - 1)]);
+  }
+  return requests;
+}
+
+// Read an access log: one request per line, "TIMESTAMP PATH" or "PATH".
+// The requests are replayed in the order of their timestamps, as fast as
+// possible. A leading '/' is removed from the paths.
+std::vector<std::string> readAccessLog(const std::string& filename)
+{
+  std::ifstream log(filename);
+  if (!log) {
+    throw std::runtime_error("Impossible to open the access log " + filename);
+  }
+  std::vector<std::pair<double, std::string>> requests;
+  for (std::string line; std::getline(log, line);) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      continue;
+    }
+    double timestamp = 0;
+    auto sep = line.find_first_of(" \t");
+    if (sep != std::string::npos) {
+      char* end;
+      auto value = strtod(line.c_str(), &end);
+      if (end == line.c_str() + sep) {
+        timestamp = value;
+        line = line.substr(line.find_first_not_of(" \t", sep));
+      }
+    }
+    if (line[0] == '/') {
+      line = line.substr(1);
+    }
+    requests.push_back(std::make_pair(timestamp, line));
+  }
+  std::stable_sort(requests.begin(), requests.end(),
+    [](const std::pair<double, std::string>& a, const std::pair<double, std::string>& b) {
+      return a.first < b.first;
+    });
+  std::vector<std::string> paths;
+  for (auto& request:requests) {
+    paths.push_back(request.second);
+  }
+  return paths;
+}
+
+// Histogram of latencies (in nanoseconds) with a bounded relative error, as
+// HdrHistogram does: the values below 2^SUB_BITS have their own bucket, above
+// each power of two is split in 2^SUB_BITS linear buckets (error < 1/64).
+class Histogram
+{
+  public:
+    static const unsigned SUB_BITS = 6;
+
+    Histogram()
+      : buckets((65 - SUB_BITS) << SUB_BITS, 0),
+        total(0),
+        sum(0),
+        sumSquares(0),
+        maxValue(0)
+    {}
+
+    void record(uint64_t value)
+    {
+      buckets[bucketOf(value)]++;
+      total++;
+      sum += value;
+      sumSquares += double(value) * value;
+      maxValue = std::max(maxValue, value);
+    }
+
+    void merge(const Histogram& other)
+    {
+      for (size_t i = 0; i < buckets.size(); i++) {
+        buckets[i] += other.buckets[i];
+      }
+      total += other.total;
+      sum += other.sum;
+      sumSquares += other.sumSquares;
+      maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+    double mean() const { return total ? double(sum) / total : 0; }
+    double variance() const
+    {
+      return total > 1 ? std::max(0.0, (sumSquares - double(sum) * sum / total) / (total - 1)) : 0;
+    }
+
+    // The highest value of the bucket holding the value of rank p*count.
+    uint64_t percentile(double p) const
+    {
+      if (total == 0) {
+        return 0;
+      }
+      uint64_t rank = std::max<uint64_t>(1, uint64_t(p * total + 0.5));
+      uint64_t seen = 0;
+      for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+          return std::min(highestValueOf(i), maxValue);
+        }
+      }
+      return maxValue;
+    }
+
+  private:
+    static unsigned shiftOf(uint64_t value)
+    {
+      unsigned msb = 0;
+      while (msb < 63 && (value >> (msb + 1))) {
+        msb++;
+      }
+      return msb > SUB_BITS ? msb - SUB_BITS : 0;
+    }
+
+    static size_t bucketOf(uint64_t value)
+    {
+      auto shift = shiftOf(value);
+      return (size_t(shift) << SUB_BITS) + (value >> shift);
+    }
+
+    static uint64_t highestValueOf(size_t bucket)
+    {
+      unsigned shift = bucket >> SUB_BITS;
+      if (shift <= 1) {
+        return bucket;
+      }
+      shift--;
+      auto lowest = uint64_t(bucket - (size_t(shift) << SUB_BITS)) << shift;
+      return lowest + (uint64_t(1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> buckets;
+    uint64_t total;
+    uint64_t sum;
+    double sumSquares;
+    uint64_t maxValue;
+};
+
+struct PhaseResult
+{
+  size_t requests = 0;
+  size_t errors = 0;
+  uint64_t size = 0;
+  double seconds = 0;
+  Histogram latency;
+};
+
+// One archive shared by all the threads (as a server does), or one archive
+// per thread to measure the reading without contention in libzim.
+std::vector<zim::Archive> openArchives(const std::string& filename, unsigned threads, bool ownArchive)
+{
+  std::vector<zim::Archive> archives;
+  for (unsigned t = 0; t < (ownArchive ? threads : 1); t++) {
+    archives.push_back(zim::Archive(filename));
+  }
+  return archives;
+}
+
+// The files of the archive: the file itself, or its parts (.zimaa, .zimab, ...).
+std::vector<std::string> archiveFiles(const std::string& filename)
+{
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0) {
+    return std::vector<std::string>(1, filename);
+  }
+  std::vector<std::string> parts;
+  for (char first = 'a'; first <= 'z'; first++) {
+    for (char second = 'a'; second <= 'z'; second++) {
+      auto part = filename + first + second;
+      if (stat(part.c_str(), &st) != 0) {
+        return parts;
+      }
+      parts.push_back(part);
+    }
+  }
+  return parts;
+}
+
+// Ask the kernel to drop the cached pages of the archive, so the next phase
+// reads from the disk. The archive must be closed: the mapped pages are not
+// dropped.
+void dropPageCache(const std::string& filename)
+{
+  for (auto& file:archiveFiles(filename)) {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Impossible to open " << file << " to drop its cached pages" << std::endl;
+      continue;
+    }
+    int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (err != 0) {
+      std::cerr << "Impossible to drop the cached pages of " << file << ": " << strerror(err) << std::endl;
+    }
+    close(fd);
+  }
+}
+
+// A comma separated list of cache sizes ("16,64,256").
+bool parseSizes(const std::string& value, std::vector<unsigned>& sizes)
+{
+  sizes.clear();
+  std::istringstream stream(value);
+  for (std::string item; std::getline(stream, item, ',');) {
+    char* end;
+    auto size = strtoul(item.c_str(), &end, 10);
+    if (item.empty() || *end != '\0') {
+      return false;
+    }
+    sizes.push_back(size);
+  }
+  return !sizes.empty();
+}
+
+// libzim reads the size of the caches of an archive in the environment when
+// the archive is opened. 0 keeps the default size of the library.
+void setCacheSize(const char* name, unsigned size)
+{
+  if (size == 0) {
+    unsetenv(name);
+  } else {
+    setenv(name, std::to_string(size).c_str(), 1);
+  }
+}
+
+// A request of a phase, returning the number of bytes read.
+typedef std::function<uint64_t (const zim::Archive& archive, size_t r)> Request;
+
+// Run the requests 0 to count-1. The thread t runs the requests t, t+threads,
+// ... so the threads go through the requests together.
+PhaseResult runRequests(const std::vector<zim::Archive>& archives, unsigned threads,
+                        size_t count, const Request& request)
+{
+  std::vector<PhaseResult> results(threads);
+  auto work = [&](unsigned t) {
+    const auto& archive = archives[t % archives.size()];
+    auto& result = results[t];
+    for (size_t r = t; r < count; r += threads) {
+      auto start = std::chrono::steady_clock::now();
+      try {
+        result.size += request(archive, r);
+      } catch(...) {
+        result.errors++;
+      }
+      auto end = std::chrono::steady_clock::now();
+      result.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+      result.requests++;
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++) {
+    workers.push_back(std::thread(work, t));
+  }
+  for (auto& worker:workers) {
+    worker.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  PhaseResult total;
+  total.seconds = std::chrono::duration<double>(end - start).count();
+  for (auto& result:results) {
+    total.requests += result.requests;
+    total.errors += result.errors;
+    total.size += result.size;
+    total.latency.merge(result.latency);
+  }
+  return total;
+}
+
+// Read the article at paths[r].
+Request readArticle(const std::vector<std::string>& paths)
+{
+  return [&paths](const zim::Archive& archive, size_t r) -> uint64_t {
+    return archive.getEntryByPath(paths[r]).getItem(true).getData().size();
+  };
+}
+
+// The phases, in the order they are run.
+const char* const PHASES[] = {
+  "linear", "random", "title", "path-iteration", "cluster-iteration", "metadata", "redirect",
+#ifdef LIBZIM_WITH_XAPIAN
+  "search",
+#endif
+};
+
+// Number of results of a title suggestion or a full-text search.
+const int RESULT_COUNT = 10;
+
+// A comma separated list of phases, or "all".
+bool parsePhases(const std::string& value, std::set<std::string>& phases)
+{
+  phases.clear();
+  std::istringstream stream(value);
+  for (std::string item; std::getline(stream, item, ',');) {
+    if (item == "all") {
+      phases.insert(std::begin(PHASES), std::end(PHASES));
+    } else if (std::find(std::begin(PHASES), std::end(PHASES), item) != std::end(PHASES)) {
+      phases.insert(item);
+    } else {
+      return false;
+    }
+  }
+  return !phases.empty();
+}
+
+// The non empty lines of a file.
+std::vector<std::string> readLines(const std::string& filename)
+{
+  std::ifstream in(filename);
+  if (!in) {
+    throw std::runtime_error("Impossible to open " + filename);
+  }
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(in, line);) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      lines.push_back(line);
+    }
+  }
+  return lines;
+}
+
+// The first `size` characters of a title, as typed in a search bar.
+std::string titlePrefix(const std::string& title, size_t size)
+{
+  size_t end = 0;
+  for (size_t chars = 0; end < title.size() && chars < size; chars++) {
+    // Skip the continuation bytes of an utf8 character.
+    do {
+      end++;
+    } while (end < title.size() && (title[end] & 0xC0) == 0x80);
+  }
+  return title.substr(0, end);
+}
+
+void printResult(const PhaseResult& result, const std::string& unit = "articles")
+{
+  std::cout << "\tsize=" << result.size << "\tt=" << result.seconds << "s\t"
+            << (static_cast<double>(result.requests) / result.seconds) << " " << unit << "/s" << std::endl;
+  auto us = [&](double ns) { return ns / 1000.0; };
+  const auto& latency = result.latency;
+  std::cout << "\tlatency (us): mean=" << us(latency.mean())
+            << " p50=" << us(latency.percentile(0.5))
+            << " p90=" << us(latency.percentile(0.9))
+            << " p99=" << us(latency.percentile(0.99))
+            << " p999=" << us(latency.percentile(0.999))
+            << " max=" << us(latency.max()) << std::endl;
+  if (result.errors) {
+    std::cerr << "\t" << result.errors << " articles could not be read" << std::endl;
+  }
+}
+
+typedef std::vector<std::pair<std::string, PhaseResult>> Results;
+
+// Information on the archive and on the host, written in the json output.
+struct RunInfo
+{
+  unsigned long seed;
+  std::string filename;
+  zim::size_type fileSize;
+  zim::entry_index_type entryCount;
+  zim::cluster_index_type clusterCount;
+  std::map<std::string, unsigned> compressions;  // Empty for split archives.
+  unsigned threads;
+  bool ownArchive;
+  std::string workload;
+  bool dropCache;
+};
+
+// Count the clusters by compression, reading their info byte.
+// The offsets of the clusters are only known in single part archives.
+std::map<std::string, unsigned> countCompressions(const zim::Archive& archive, const std::string& filename)
 {
-  std::string url;
-  for (unsigned n = 0; n < 10; ++n)
-    url += static_cast<char>('A' + rand() % 26);
-  return url;
+  std::map<std::string, unsigned> compressions;
+  if (archive.isMultiPart()) {
+    return compressions;
+  }
+  std::ifstream in(filename, std::ios::binary);
+  for (zim::cluster_index_type i = 0; i < archive.getClusterCount(); i++) {
+    char info = 0;
+    in.seekg(archive.getClusterOffset(i));
+    if (!in.read(&info, 1)) {
+      break;
+    }
+    compressions[compressionName(info)]++;
+  }
+  return compressions;
+}
+
+void writeJson(std::ostream& out, const RunInfo& info, const Results& results)
+{
+  struct utsname host;
+  if (uname(&host) != 0) {
+    memset(&host, 0, sizeof(host));
+  }
+  out << std::setprecision(10);
+  out << "{\n"
+      << "  \"version\": " << jsonString(VERSION) << ",\n"
+      << "  \"seed\": " << info.seed << ",\n"
+      << "  \"host\": {\"name\": " << jsonString(host.nodename)
+      << ", \"system\": " << jsonString(host.sysname)
+      << ", \"release\": " << jsonString(host.release)
+      << ", \"machine\": " << jsonString(host.machine)
+      << ", \"cpus\": " << std::thread::hardware_concurrency() << "},\n"
+      << "  \"file\": {\"path\": " << jsonString(info.filename)
+      << ", \"size\": " << info.fileSize
+      << ", \"entries\": " << info.entryCount
+      << ", \"clusters\": " << info.clusterCount
+      << ", \"compressions\": {";
+  for (auto it = info.compressions.begin(); it != info.compressions.end(); ++it) {
+    out << (it == info.compressions.begin() ? "" : ", ") << jsonString(it->first) << ": " << it->second;
+  }
+  out << "}},\n"
+      << "  \"options\": {\"threads\": " << info.threads
+      << ", \"own_archive\": " << (info.ownArchive ? "true" : "false")
+      << ", \"workload\": " << jsonString(info.workload)
+      << ", \"drop_page_cache\": " << (info.dropCache ? "true" : "false") << "},\n"
+      << "  \"phases\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& result = results[i].second;
+    const auto& latency = result.latency;
+    out << (i ? "," : "") << "\n    {\"name\": " << jsonString(results[i].first)
+        << ", \"requests\": " << result.requests
+        << ", \"errors\": " << result.errors
+        << ", \"size\": " << result.size
+        << ", \"seconds\": " << result.seconds
+        << ", \"throughput\": " << (static_cast<double>(result.requests) / result.seconds)
+        << ",\n     \"latency_ns\": {\"mean\": " << latency.mean()
+        << ", \"variance\": " << latency.variance()
+        << ", \"p50\": " << latency.percentile(0.5)
+        << ", \"p90\": " << latency.percentile(0.9)
+        << ", \"p99\": " << latency.percentile(0.99)
+        << ", \"p999\": " << latency.percentile(0.999)
+        << ", \"max\": " << latency.max() << "}}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+// A minimal json parser, enough to read back the output of zimbench.
+struct JsonValue
+{
+  enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+  Type type = NUL;
+  double number = 0;
+  std::string string;
+  std::vector<JsonValue> array;
+  std::map<std::string, JsonValue> object;
+
+  const JsonValue& operator[](const std::string& key) const
+  {
+    static const JsonValue null;
+    auto it = object.find(key);
+    return it == object.end() ? null : it->second;
+  }
+};
+
+class JsonParser
+{
+  public:
+    explicit JsonParser(const std::string& text) : text(text), pos(0) {}
+
+    JsonValue parse()
+    {
+      auto value = parseValue();
+      skipSpaces();
+      if (pos != text.size()) {
+        fail();
+      }
+      return value;
+    }
+
+  private:
+    void fail() const
+    {
+      throw std::runtime_error("Invalid json at offset " + std::to_string(pos));
+    }
+
+    void skipSpaces()
+    {
+      while (pos < text.size() && isspace((unsigned char)text[pos])) {
+        pos++;
+      }
+    }
+
+    bool consume(char c)
+    {
+      skipSpaces();
+      if (pos < text.size() && text[pos] == c) {
+        pos++;
+        return true;
+      }
+      return false;
+    }
+
+    void expect(char c)
+    {
+      if (!consume(c)) {
+        fail();
+      }
+    }
+
+    bool consumeWord(const char* word)
+    {
+      auto len = strlen(word);
+      if (text.compare(pos, len, word) == 0) {
+        pos += len;
+        return true;
+      }
+      return false;
+    }
+
+    std::string parseString()
+    {
+      expect('"');
+      std::string out;
+      while (pos < text.size() && text[pos] != '"') {
+        char c = text[pos++];
+        if (c != '\\') {
+          out += c;
+          continue;
+        }
+        if (pos >= text.size()) {
+          fail();
+        }
+        c = text[pos++];
+        switch (c) {
+          case 'n': out += '\n'; break;
+          case 't': out += '\t'; break;
+          case 'r': out += '\r'; break;
+          case 'b': out += '\b'; break;
+          case 'f': out += '\f'; break;
+          case 'u': {
+            // Only the escaped control characters written by zimbench.
+            if (pos + 4 > text.size()) {
+              fail();
+            }
+            out += char(strtol(text.substr(pos, 4).c_str(), nullptr, 16));
+            pos += 4;
+            break;
+          }
+          default: out += c;
+        }
+      }
+      expect('"');
+      return out;
+    }
+
+    JsonValue parseValue()
+    {
+      JsonValue value;
+      skipSpaces();
+      if (pos >= text.size()) {
+        fail();
+      }
+      char c = text[pos];
+      if (c == '{') {
+        value.type = JsonValue::OBJECT;
+        pos++;
+        if (!consume('}')) {
+          do {
+            skipSpaces();
+            auto key = parseString();
+            expect(':');
+            value.object[key] = parseValue();
+          } while (consume(','));
+          expect('}');
+        }
+      } else if (c == '[') {
+        value.type = JsonValue::ARRAY;
+        pos++;
+        if (!consume(']')) {
+          do {
+            value.array.push_back(parseValue());
+          } while (consume(','));
+          expect(']');
+        }
+      } else if (c == '"') {
+        value.type = JsonValue::STRING;
+        value.string = parseString();
+      } else if (consumeWord("true")) {
+        value.type = JsonValue::BOOL;
+        value.number = 1;
+      } else if (consumeWord("false")) {
+        value.type = JsonValue::BOOL;
+      } else if (consumeWord("null")) {
+        value.type = JsonValue::NUL;
+      } else {
+        char* end;
+        value.type = JsonValue::NUMBER;
+        value.number = strtod(text.c_str() + pos, &end);
+        if (end == text.c_str() + pos) {
+          fail();
+        }
+        pos = end - text.c_str();
+      }
+      return value;
+    }
+
+    const std::string& text;
+    size_t pos;
+};
+
+// A phase is a regression if its mean latency is higher than in the
+// baseline by more than MIN_REGRESSION, and the difference is significant
+// (Welch's t-test, p < SIGNIFICANCE). There are many requests per phase,
+// so the distribution of t is approximated by the normal distribution.
+const double MIN_REGRESSION = 0.05;
+const double SIGNIFICANCE = 0.001;
+
+// Return the number of regressions.
+unsigned compareResults(const std::string& baselineFile, const Results& results)
+{
+  std::ifstream in(baselineFile);
+  if (!in) {
+    throw std::runtime_error("Impossible to open the baseline " + baselineFile);
+  }
+  std::stringstream buffer;
+  buffer << in.rdbuf();
+  const auto text = buffer.str();
+  const auto baseline = JsonParser(text).parse();
+
+  unsigned regressions = 0;
+  std::cout << "\ncomparison with " << baselineFile << " (mean latency in us):\n"
+               "phase\tbaseline\tcurrent\tchange\tp-value" << std::endl;
+  for (auto& named:results) {
+    const JsonValue* base = nullptr;
+    for (auto& phase:baseline["phases"].array) {
+      if (phase["name"].string == named.first) {
+        base = &phase;
+      }
+    }
+    if (!base) {
+      std::cout << named.first << "\tnot in the baseline" << std::endl;
+      continue;
+    }
+    const auto& latency = named.second.latency;
+    const double baseMean = (*base)["latency_ns"]["mean"].number;
+    const double baseVariance = (*base)["latency_ns"]["variance"].number;
+    const double baseCount = (*base)["requests"].number;
+    const double mean = latency.mean();
+    const double count = latency.count();
+    const double stderr2 = (baseCount > 0 ? baseVariance / baseCount : 0)
+                         + (count > 0 ? latency.variance() / count : 0);
+    const double t = stderr2 > 0 ? (mean - baseMean) / sqrt(stderr2) : 0;
+    const double pValue = erfc(fabs(t) / sqrt(2));
+    const double change = baseMean > 0 ? mean / baseMean - 1 : 0;
+    const bool regression = change > MIN_REGRESSION && pValue < SIGNIFICANCE;
+    regressions += regression;
+    std::cout << named.first << '\t' << baseMean / 1000 << "\t\t" << mean / 1000 << '\t'
+              << (change >= 0 ? "+" : "") << change * 100 << "%\t" << pValue
+              << (regression ? "\tREGRESSION" : "") << std::endl;
+  }
+  return regressions;
 }
 
 int main(int argc, char* argv[])
@@ -49,22 +802,47 @@ int main(int argc, char* argv[])
   unsigned int randomCount = 1000;
   bool distinctCountSet = false;
   unsigned int distinctCount = 1000;
-  char ns = 'A';
+  unsigned int threads = 1;
+  bool ownArchive = false;
+  Workload workload;
+  std::string workloadName = "uniform";
+  bool dropCache = false;
+  std::vector<unsigned> clusterCacheSizes(1, 0);
+  std::vector<unsigned> direntCacheSizes(1, 0);
+  bool sweep = false;
+  unsigned long seed = time(0);
+  std::string jsonFile;
+  std::string baselineFile;
+  std::set<std::string> phases = {"linear", "random"};
+  std::string queryFile;
   std::string filename;
 
   static struct option long_options[]
-    = {{"ns", required_argument, 0, 's'}};
+    = {{"ns", required_argument, 0, 's'},
+       {"threads", required_argument, 0, 't'},
+       {"own-archive", no_argument, 0, 'o'},
+       {"workload", required_argument, 0, 'w'},
+       {"drop-page-cache", no_argument, 0, 'D'},
+       {"cluster-cache", required_argument, 0, 'C'},
+       {"dirent-cache", required_argument, 0, 'E'},
+       {"seed", required_argument, 0, 'S'},
+       {"json", required_argument, 0, 'j'},
+       {"compare", required_argument, 0, 'c'},
+       {"phases", required_argument, 0, 'p'},
+       {"queries", required_argument, 0, 'q'},
+       {0, 0, 0, 0}};
   try
   {
     while (true) {
       int option_index = 0;
-      int c = getopt_long(argc, argv, "vsn:r:d:",
+      int c = getopt_long(argc, argv, "vsn:r:d:t:ow:DC:E:S:j:c:p:q:",
               long_options, &option_index);
 
       if (c!= -1) {
         switch (c) {
           case 's':
-            ns = optarg[0];
+            // The paths are looked up without namespace, the option is kept
+            // for compatibility.
             break;
           case 'n':
             count = atoi(optarg);
@@ -86,6 +864,48 @@ int main(int argc, char* argv[])
             distinctCountSet = true;
             distinctCount = atoi(optarg);
             break;
+          case 't':
+            threads = std::max(1, atoi(optarg));
+            break;
+          case 'o':
+            ownArchive = true;
+            break;
+          case 'w':
+            if (!parseWorkload(optarg, workload)) {
+              std::cerr << "Invalid workload " << optarg << std::endl;
+              return 1;
+            }
+            workloadName = optarg;
+            break;
+          case 'D':
+            dropCache = true;
+            break;
+          case 'C':
+          case 'E':
+            if (!parseSizes(optarg, c == 'C' ? clusterCacheSizes : direntCacheSizes)) {
+              std::cerr << "Invalid list of cache sizes " << optarg << std::endl;
+              return 1;
+            }
+            sweep = true;
+            break;
+          case 'S':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+          case 'j':
+            jsonFile = optarg;
+            break;
+          case 'c':
+            baselineFile = optarg;
+            break;
+          case 'p':
+            if (!parsePhases(optarg, phases)) {
+              std::cerr << "Invalid list of phases " << optarg << std::endl;
+              return 1;
+            }
+            break;
+          case 'q':
+            queryFile = optarg;
+            break;
           case 'v':
             version();
             return 0;
@@ -104,92 +924,228 @@ int main(int argc, char* argv[])
         "usage: " << argv[0] << " [options] zimfile\n"
         "\t-n number\tnumber of linear accessed articles (default 1000)\n"
         "\t-r number\tnumber of random accessed articles (default: same as -n)\n"
-        "\t-d number\tnumber of distinct articles used for random access (default: same as -r)\n\n"
+        "\t-d number\tnumber of distinct articles used for random access (default: same as -r)\n"
+        "\t-t, --threads=number\tnumber of threads reading the articles (default 1)\n"
+        "\t-o, --own-archive\teach thread opens its own archive instead of sharing one\n"
+        "\t-w, --workload=workload\thow the random accessed articles are drawn among the distinct articles:\n"
+        "\t\tuniform\tall with the same probability (default)\n"
+        "\t\tzipf[:skew]\tfollowing a Zipf distribution of exponent skew (default 1.0)\n"
+        "\t\treplay:file\tthe paths of an access log (\"[timestamp] path\" per line),\n"
+        "\t\t\tin the order of their timestamps (-r and -d are not used)\n"
+        "\t-D, --drop-page-cache\tdrop the archive from the page cache of the system before each phase\n"
+        "\t-C, --cluster-cache=n,m,...\tsizes of the cluster cache of libzim to compare on the random access\n"
+        "\t-E, --dirent-cache=n,m,...\tsizes of the dirent cache of libzim to compare on the random access\n"
+        "\t\t\t(0 is the default size of libzim)\n"
+        "\t-S, --seed=number\tseed of the random generator (default: the current time)\n"
+        "\t-j, --json=file\twrite the information on the run and the results in a json file\n"
+        "\t-c, --compare=file\tcompare the results with a json file written by a previous run;\n"
+        "\t\t\treturn 2 if the mean latency of a phase is more than 5% higher, with p < 0.001\n"
+        "\t-p, --phases=list\tcomma separated list of the phases to run, or all (default: linear,random):\n"
+        "\t\tlinear\t\t\tread the first articles in path order\n"
+        "\t\trandom\t\t\tread the random accessed articles\n"
+        "\t\ttitle\t\t\tfind the first titles starting by a prefix (the first 3 characters\n"
+        "\t\t\t\t\tof the titles of random articles, or the queries)\n"
+        "\t\tpath-iteration\t\tread all the entries in path order\n"
+        "\t\tcluster-iteration\tread all the entries in cluster order\n"
+        "\t\tmetadata\t\tread the metadata\n"
+        "\t\tredirect\t\tresolve random redirects\n"
+#ifdef LIBZIM_WITH_XAPIAN
+        "\t\tsearch\t\t\tfull-text search of the queries\n"
+#endif
+        "\t-q, --queries=file\tqueries of the title and search phases, one per line\n\n"
         "\t-v to print the software version\n"
                 << std::flush;
       return 1;
     }
 
-    srand(time(0));
+    std::cout << "seed " << seed << std::endl;
+    std::mt19937_64 rng(seed);
+    RunInfo info;
+    info.seed = seed;
+    info.filename = filename;
+    info.threads = threads;
+    info.ownArchive = ownArchive;
+    info.workload = workloadName;
+    info.dropCache = dropCache;
 
-    std::cout << "open file " << filename << std::endl;
-    zim::Archive archive(filename);
+    // The requests are drawn before the measure, not to time the generator.
+    // The archive used to draw them is closed before the measure.
+    std::vector<std::string> linearPaths;
+    std::vector<std::string> randomPaths;
+    std::vector<std::string> titlePrefixes;
+    std::vector<std::string> metadataKeys;
+    std::vector<std::string> redirectPaths;
+    std::vector<std::string> queries;
+    if (!queryFile.empty()) {
+      queries = readLines(queryFile);
+    }
+#ifdef LIBZIM_WITH_XAPIAN
+    bool fulltextIndex;
+#endif
+    {
+      std::cout << "open file " << filename << std::endl;
+      zim::Archive archive(filename);
+      info.fileSize = archive.getFilesize();
+      info.entryCount = archive.getEntryCount();
+      info.clusterCount = archive.getClusterCount();
+      info.compressions = countCompressions(archive, filename);
+#ifdef LIBZIM_WITH_XAPIAN
+      fulltextIndex = archive.hasFulltextIndex();
+#endif
 
-    // collect urls
-    typedef std::set<std::string> UrlsType;
-    typedef std::vector<std::string> RandomUrlsType;
-    UrlsType urls;
-    RandomUrlsType randomUrls;
+      // collect urls
+      typedef std::set<std::string> UrlsType;
+      UrlsType urls;
 
-    std::cout << "collect linear urls" << std::endl;
-    for (auto& entry: archive.iterByPath())
-    {
-      if (urls.size() >= count) {
-        break;
+      std::cout << "collect linear urls" << std::endl;
+      for (auto& entry: archive.iterByPath())
+      {
+        if (urls.size() >= count) {
+          break;
+        }
+        std::cout << "check url " << entry.getPath() << '\t' << urls.size() << " found" << std::endl;
+        if (!entry.isRedirect())
+          urls.insert(entry.getPath());
       }
-      std::cout << "check url " << entry.getPath() << '\t' << urls.size() << " found" << std::endl;
-      if (!entry.isRedirect())
-        urls.insert(entry.getPath());
-    }
 
-    std::cout << urls.size() << " urls collected" << std::endl;
+      std::cout << urls.size() << " urls collected" << std::endl;
 
-    std::cout << "collect random urls" << std::endl;
-    while (randomUrls.size() < distinctCount)
-    {
-      auto entry = archive.getEntryByPath(randomUrl());
-      if (!entry.isRedirect())
-        randomUrls.push_back(entry.getPath());
+      linearPaths.assign(urls.begin(), urls.end());
+      if (workload.kind == Workload::REPLAY) {
+        std::cout << "read access log " << workload.logFile << std::endl;
+        randomPaths = readAccessLog(workload.logFile);
+      } else {
+        std::cout << "collect random urls" << std::endl;
+        auto randomUrls = pickEntries(archive, distinctCount, rng);
+        std::cout << randomUrls.size() << " random urls collected" << std::endl;
+        auto skew = workload.kind == Workload::ZIPF ? workload.skew : 0;
+        randomPaths = drawRequests(randomUrls, randomCount, skew, rng);
+      }
+      std::cout << randomPaths.size() << " random requests" << std::endl;
+
+      if (phases.count("title")) {
+        std::vector<std::string> prefixes = queries;
+        if (prefixes.empty()) {
+          for (auto& path:pickEntries(archive, distinctCount, rng)) {
+            prefixes.push_back(titlePrefix(archive.getEntryByPath(path).getTitle(), 3));
+          }
+        }
+        titlePrefixes = drawRequests(prefixes, randomCount, 0, rng);
+      }
+      if (phases.count("metadata")) {
+        metadataKeys = archive.getMetadataKeys();
+      }
+      if (phases.count("redirect")) {
+        redirectPaths = drawRequests(pickEntries(archive, distinctCount, rng, true), randomCount, 0, rng);
+      }
     }
 
-    std::cout << randomUrls.size() << " random urls collected" << std::endl;
+    std::cout << threads << " thread(s) reading "
+              << (ownArchive || threads == 1 ? "their own archive" : "a shared archive") << std::endl;
 
     // reopen file
-    archive = zim::Archive(filename);
+    std::vector<zim::Archive> archives;
+    auto reopen = [&]() {
+      archives.clear();
+      if (dropCache) {
+        dropPageCache(filename);
+      }
+      archives = openArchives(filename, threads, ownArchive);
+    };
+
+    Results results;
+    auto runPhase = [&](const std::string& name, size_t count, const Request& request) {
+      if (!phases.count(name)) {
+        return;
+      }
+      std::cout << name << ":" << std::flush;
+      if (count == 0) {
+        std::cout << "\tskipped, nothing to request" << std::endl;
+        return;
+      }
+      reopen();
+      results.push_back(std::make_pair(name, runRequests(archives, threads, count, request)));
+      printResult(results.back().second, name == "linear" || name == "random" ? "articles" : "requests");
+    };
 
-    // linear read
-    std::cout << "linear:" << std::flush;
-    auto start = std::chrono::steady_clock::now();
+    runPhase("linear", linearPaths.size(), readArticle(linearPaths));
+    runPhase("random", randomPaths.size(), readArticle(randomPaths));
 
-    unsigned size = 0;
-    for (UrlsType::const_iterator it = urls.begin(); it != urls.end(); ++it) {
-      try {
-        auto entry = archive.getEntryByPath(*it);
-        size += entry.getItem(true).getData().size();
-      } catch(...) {
-        std::cerr << "Impossible to get article '" << *it << "' in namespace " << ns << std::endl;
+    runPhase("title", titlePrefixes.size(), [&](const zim::Archive& archive, size_t r) -> uint64_t {
+      uint64_t size = 0;
+      for (auto& entry:archive.findByTitle(titlePrefixes[r]).offset(0, RESULT_COUNT)) {
+        size += entry.getTitle().size();
       }
-    }
+      return size;
+    });
 
-    auto end = std::chrono::steady_clock::now();
-    std::chrono::duration<double> diff = end - start;
-    std::cout << "\tsize=" << size << "\tt=" << diff.count() << "s\t" << (static_cast<double>(urls.size()) / diff.count()) << " articles/s" << std::endl;
+    // Same order than iterByPath and iterEfficient, but by index so the
+    // threads can share the walk.
+    auto readEntry = [](const zim::Entry& entry) -> uint64_t {
+      return entry.isRedirect() ? 0 : entry.getItem().getData().size();
+    };
+    runPhase("path-iteration", info.entryCount, [&](const zim::Archive& archive, size_t r) {
+      return readEntry(archive.getEntryByPath(zim::entry_index_type(r)));
+    });
+    runPhase("cluster-iteration", info.entryCount, [&](const zim::Archive& archive, size_t r) {
+      return readEntry(archive.getEntryByClusterOrder(zim::entry_index_type(r)));
+    });
 
-    // reopen file
-    archive = zim::Archive(filename);
+    runPhase("metadata", metadataKeys.empty() ? 0 : randomCount, [&](const zim::Archive& archive, size_t r) -> uint64_t {
+      return archive.getMetadata(metadataKeys[r % metadataKeys.size()]).size();
+    });
 
-    // random access
-    std::cout << "random:" << std::flush;
+    runPhase("redirect", redirectPaths.size(), [&](const zim::Archive& archive, size_t r) -> uint64_t {
+      return archive.getEntryByPath(redirectPaths[r]).getItem(true).getPath().size();
+    });
 
-    start = std::chrono::steady_clock::now();
+#ifdef LIBZIM_WITH_XAPIAN
+    runPhase("search", fulltextIndex ? queries.size() : 0, [&](const zim::Archive& archive, size_t r) -> uint64_t {
+      zim::Search search(archive);
+      search.set_query(queries[r]);
+      search.set_range(0, RESULT_COUNT);
+      uint64_t size = 0;
+      for (auto it = search.begin(); it != search.end(); ++it) {
+        size += it.get_title().size();
+      }
+      return size;
+    });
+#endif
 
-    size = 0;
-    for (unsigned r = 0; r < randomCount; ++r) {
-      try {
-        auto entry = archive.getEntryByPath(randomUrls[rand() % randomUrls.size()]);
-        size += entry.getItem(true).getData().size();
-      } catch(...) {}
+    if (sweep) {
+      std::cout << "\nrandom access by cache sizes (0 is the default size):\n"
+                   "cluster cache\tdirent cache\tarticles/s\tp50 (us)\tp99 (us)" << std::endl;
+      for (auto clusterCacheSize:clusterCacheSizes) {
+        for (auto direntCacheSize:direntCacheSizes) {
+          setCacheSize("ZIM_CLUSTERCACHE", clusterCacheSize);
+          setCacheSize("ZIM_DIRENTCACHE", direntCacheSize);
+          reopen();
+          auto result = runRequests(archives, threads, randomPaths.size(), readArticle(randomPaths));
+          std::cout << clusterCacheSize << "\t\t" << direntCacheSize << "\t\t"
+                    << (static_cast<double>(result.requests) / result.seconds) << "\t\t"
+                    << result.latency.percentile(0.5) / 1000.0 << "\t\t"
+                    << result.latency.percentile(0.99) / 1000.0 << std::endl;
+          std::ostringstream name;
+          name << "random cluster_cache=" << clusterCacheSize << " dirent_cache=" << direntCacheSize;
+          results.push_back(std::make_pair(name.str(), result));
+        }
+      }
     }
-    //for (UrlsType::const_iterator it = randomUrls.begin(); it != randomUrls.end(); ++it)
-      //size += file.getArticle(ns, *it).getData().size();
 
-    end = std::chrono::steady_clock::now();
-    diff = end - start;
-    std::cout << "\tsize=" << size << "\tt=" << diff.count() << "s\t" << (static_cast<double>(randomCount) / diff.count()) << " articles/s" << std::endl;
+    if (!jsonFile.empty()) {
+      std::ofstream out(jsonFile);
+      writeJson(out, info, results);
+      if (!out) {
+        throw std::runtime_error("Impossible to write the results in " + jsonFile);
+      }
+    }
+
+    if (!baselineFile.empty() && compareResults(baselineFile, results) > 0) {
+      return 2;
+    }
   }
   catch (const std::exception& e)
   {
     std::cerr << e.what() << std::endl;
   }
 }
-
@@ -1,5 +1,6 @@
 #include "checks.h"
 #include "../tools.h"
+#include "../trace.h"
 
 #include <map>
 #include <unordered_map>
@@ -81,17 +82,19 @@ void test_mainpage(const zim::Archive& archive, ErrorLogger& reporter) {
 }
 
 
-void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressBar progress,
+void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressBar& progress,
                    const EnabledTests checks) {
+    ZIM_TRACE_SCOPE("test_articles");
     std::cout << "[INFO] Verifying Articles' content..." << std::endl;
     // Article are store in a map<hash, list<index>>.
     // So all article with the same hash will be stored in the same list.
-    std::map<unsigned int, std::list<zim::entry_index_type>> hash_main;
+    std::map<uint64_t, std::list<zim::entry_index_type>> hash_main;
 
     int previousIndex = -1;
 
     progress.reset(archive.getEntryCount());
     for (auto& entry:archive.iterEfficient()) {
+        ZIM_TRACE_SCOPE("test_articles/entry");
         progress.report();
         auto path = entry.getPath();
         char ns = archive.hasNewNamespaceScheme() ? 'C' : path[0];
@@ -117,11 +120,16 @@ void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressB
         }
 
         std::string data;
-        if (checks.isEnabled(TestType::REDUNDANT) || item.getMimetype() == "text/html")
+        if (checks.isEnabled(TestType::REDUNDANT) || item.getMimetype() == "text/html") {
+            ZIM_TRACE_SCOPE("test_articles/getData");
             data = item.getData();
+            ZIM_TRACE_COUNT("test_articles/bytes", data.size());
+        }
 
-        if(checks.isEnabled(TestType::REDUNDANT))
-            hash_main[adler32(data)].push_back( item.getIndex() );
+        if(checks.isEnabled(TestType::REDUNDANT)) {
+            ZIM_TRACE_SCOPE("test_articles/hash");
+            hash_main[contentHash64(data.data(), data.size())].push_back( item.getIndex() );
+        }
 
         if (item.getMimetype() != "text/html")
             continue;
@@ -129,17 +137,20 @@ void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressB
         std::vector<html_link> links;
         if (checks.isEnabled(TestType::URL_INTERNAL) ||
             checks.isEnabled(TestType::URL_EXTERNAL)) {
+            ZIM_TRACE_SCOPE("test_articles/getLinks");
             links = generic_getLinks(data);
         }
 
         if(checks.isEnabled(TestType::URL_INTERNAL))
         {
+            ZIM_TRACE_SCOPE("test_articles/internalUrls");
             auto baseUrl = path;
             auto pos = baseUrl.find_last_of('/');
             baseUrl.resize( pos==baseUrl.npos ? 0 : pos );
 
             std::unordered_map<std::string, std::vector<std::string>> filtered;
             int nremptylinks = 0;
+            std::string normalized;
             for (const auto &l : links)
             {
                 if (l.link.front() == '#' || l.link.front() == '?') continue;
@@ -151,7 +162,7 @@ void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressB
                 }
 
 
-                if (isOutofBounds(l.link, baseUrl))
+                if (!normalizeLink(l.link.data(), l.link.size(), baseUrl.data(), baseUrl.size(), normalized))
                 {
                     std::ostringstream ss;
                     ss << l.link << " is out of bounds. Article: " << path;
@@ -160,7 +171,6 @@ void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressB
                     continue;
                 }
 
-                auto normalized = normalize_link(l.link, baseUrl);
                 filtered[normalized].push_back(l.link);
             }
 
@@ -208,8 +218,11 @@ void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressB
         }
     }
 
+    progress.finish();
+
     if (checks.isEnabled(TestType::REDUNDANT))
     {
+        ZIM_TRACE_SCOPE("test_articles/redundant");
         std::cout << "[INFO] Searching for redundant articles..." << std::endl;
         std::cout << "  Verifying Similar Articles for redundancies..." << std::endl;
         std::ostringstream output_details;
@@ -242,5 +255,6 @@ void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressB
                 }
             }
         }
+        progress.finish();
     }
 }
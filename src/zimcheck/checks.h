@@ -131,7 +131,7 @@ void test_integrity(const std::string& filename, ErrorLogger& reporter);
 void test_metadata(const zim::Archive& archive, ErrorLogger& reporter);
 void test_favicon(const zim::Archive& archive, ErrorLogger& reporter);
 void test_mainpage(const zim::Archive& archive, ErrorLogger& reporter);
-void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressBar progress,
+void test_articles(const zim::Archive& archive, ErrorLogger& reporter, ProgressBar& progress,
                    const EnabledTests enabled_tests);
 
 #endif
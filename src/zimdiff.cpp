@@ -17,6 +17,8 @@
  * MA 02110-1301, USA.
  */
 
+#define ZIM_PRIVATE
+
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -27,8 +29,13 @@
 #include <list>
 #include <algorithm>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <exception>
 
 #include "tools.h"
+#include "diffchain.h"
+#include "trace.h"
 
 #include "version.h"
 
@@ -40,141 +47,430 @@ std::string NumberToString(int number)
 }
 
 
-void create(const std::string& filename_1, const std::string& filename_2, const std::string& outpath)
+// Size and content hash of an item.
+struct ItemDigest
+{
+  zim::size_type size;
+  ContentHash hash;
+
+  bool operator==(const ItemDigest& other) const { return size == other.size && hash == other.hash; }
+};
+
+// Compute the size and the content hash of the items at `indexes` in `archive`.
+// The items are read in cluster order, each thread taking a contiguous slice
+// of the clusters, so every cluster is decompressed once and by one thread.
+// The digests are returned in the order of `indexes`.
+std::vector<ItemDigest> hashItems(const zim::Archive& archive,
+                                   const std::vector<zim::entry_index_type>& indexes,
+                                   unsigned int nbThreads)
 {
+  std::vector<std::pair<zim::cluster_index_type, size_t>> order;
+  order.reserve(indexes.size());
+  for (size_t i=0; i<indexes.size(); i++) {
+    auto item = archive.getEntryByPath(indexes[i]).getItem();
+    order.push_back(std::make_pair(item.getClusterIndex(), i));
+  }
+  std::sort(order.begin(), order.end());
+
+  std::vector<ItemDigest> digests(indexes.size());
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  auto worker = [&](size_t begin, size_t end) {
+    try {
+      for (size_t i=begin; i<end; i++) {
+        auto pos = order[i].second;
+        auto blob = archive.getEntryByPath(indexes[pos]).getItem().getData();
+        digests[pos].size = blob.size();
+        digests[pos].hash = contentHash128(blob.data(), blob.size());
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  };
+
+  nbThreads = std::max(1U, std::min<unsigned int>(nbThreads, order.size()));
+  std::vector<std::thread> threads;
+  const size_t sliceSize = (order.size() + nbThreads - 1) / nbThreads;
+  for (unsigned int t=0; t<nbThreads; t++) {
+    auto begin = std::min(order.size(), t*sliceSize);
+    auto end = std::min(order.size(), begin+sliceSize);
+    threads.push_back(std::thread(worker, begin, end));
+  }
+  for (auto& thread:threads) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return digests;
+}
+
+// Add the new version (item2, with the given content) of a modified item to
+// the diff file. If a binary delta against the old version is much smaller
+// than the new content, the delta is stored instead and the item is added to
+// deltaList. The delta is stored as "application/octet-stream" (not to be
+// read or indexed as the content), the mimetype is the one of the old
+// version, so it is only used if the mimetype has not changed.
+void addModifiedItem(zim::writer::Creator& zimCreator, const zim::Entry& entry1,
+                     std::shared_ptr<zim::writer::Item> item2, const char* content, size_t size,
+                     Bitset& deltaList)
+{
+  ZIM_TRACE_SCOPE("zimdiff/addModifiedItem");
+  auto item1 = entry1.getItem();
+  if (item1.getMimetype() != item2->getMimeType()) {
+    zimCreator.addItem(item2);
+    return;
+  }
+  auto blob1 = item1.getData();
+  auto delta = computeDelta(blob1.data(), blob1.size(), content, size);
+  if (delta.size() < size / 2) {
+    zimCreator.addItem(zim::writer::StringItem::create(item2->getPath(), "application/octet-stream", item2->getTitle(), delta));
+    deltaList.set(entry1.getIndex());
+    return;
+  }
+  zimCreator.addItem(item2);
+}
+
+void addModifiedItem(zim::writer::Creator& zimCreator, const zim::Entry& entry1, const zim::Item& item2,
+                     Bitset& deltaList)
+{
+  auto blob2 = item2.getData();
+  auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(item2));
+  addModifiedItem(zimCreator, entry1, tmpItem, blob2.data(), blob2.size(), deltaList);
+}
+
+//Uuid stored as metadata : one number per line.
+std::string uuidMetadata(const zim::Uuid& uuid)
+{
+  std::string metadata;
+  const char *s=uuid.data;
+  for(int i=0;i<16;i++)
+  {
+    metadata+=NumberToString((int)s[i]);
+    metadata+="\n";
+  }
+  return metadata;
+}
+
+void create(const std::string& filename_1, const std::string& filename_2, const std::string& outpath,
+            unsigned int nbThreads, bool verify)
+{
+  ZIM_TRACE_SCOPE("zimdiff/create");
   zim::writer::Creator zimCreator;
   zimCreator.startZimCreation(outpath);
 
   zim::Archive archive_1(filename_1);
   zim::Archive archive_2(filename_2);
 
-
   //dlist article.
-  //List of articles to be deleted from start_file.
-  std::string dlist;
-  for(auto& entry:archive_1.iterByPath())
-  {
-    try {
-      archive_2.getEntryByPath(entry.getPath());
-    } catch(...) {
-      dlist+=entry.getPath()+"\n";
+  //Set of articles to be deleted from start_file.
+  Bitset dlist(archive_1.getAllEntryCount());
+  //Articles of start_file which are redirects in end_file.
+  //The new redirects are directly stored in the diff file.
+  RedirectListWriter redirectList;
+  //Set of the modified articles stored as a delta against the start_file.
+  Bitset deltaList(archive_1.getAllEntryCount());
+
+  // Items present in both files.
+  // Their size and content are compared after the walk, in cluster order:
+  // reading the size of an item in path order would decompress its cluster.
+  std::vector<zim::entry_index_type> candidates_1;
+  std::vector<zim::entry_index_type> candidates_2;
+
+  // State of the clusters of file_1 : a cluster is unchanged if all its
+  // items are kept with the same content in file_2.
+  enum ClusterState : char { NO_ITEM, UNCHANGED, CHANGED };
+  std::vector<char> clusterStates(archive_1.getClusterCount(), NO_ITEM);
+  auto markCluster = [&](const zim::Entry& entry, ClusterState state) {
+    if (entry.isRedirect()) {
+      return;
     }
-  }
-  zimCreator.addMetadata("dlist", dlist);
+    auto& current = clusterStates[entry.getItem().getClusterIndex()];
+    current = std::max(current, char(state));
+  };
 
-  std::string redirectList;
-  for(auto& entry:archive_2.iterByPath())
-  {
-    if(entry.isRedirect())
-    {
-      redirectList+=entry.getPath()+"\n"+entry.getRedirectEntry().getPath()+"\n";
+  // Walk both files in path order at the same time.
+  auto range_1 = archive_1.iterByPath();
+  auto range_2 = archive_2.iterByPath();
+  auto it_1 = range_1.begin();
+  auto it_2 = range_2.begin();
+  while (it_1 != range_1.end() || it_2 != range_2.end()) {
+    ZIM_TRACE_SCOPE("zimdiff/entry");
+    int cmp;
+    if (it_1 == range_1.end()) {
+      cmp = 1;
+    } else if (it_2 == range_2.end()) {
+      cmp = -1;
+    } else {
+      cmp = it_1->getPath().compare(it_2->getPath());
+    }
+
+    if (cmp < 0) {
+      // Only in file_1 : the article has been deleted.
+      dlist.set(it_1->getIndex());
+      markCluster(*it_1, CHANGED);
+      ++it_1;
+      continue;
+    }
+
+    auto& entry2 = *it_2;
+    if (cmp > 0) {
+      //If the article is not present in file_1
+      if (entry2.isRedirect()) {
+        zimCreator.addRedirection(entry2.getPath(), entry2.getTitle(), entry2.getRedirectEntry().getPath());
+      } else {
+        auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry2.getItem()));
+        zimCreator.addItem(tmpItem);
+      }
+      ++it_2;
+      continue;
     }
+
+    auto& entry1 = *it_1;
+    if (entry2.isRedirect()) {
+      // An unchanged redirect is copied from file_1 by zimpatch.
+      auto redirectTarget = entry2.getRedirectEntry().getPath();
+      if (!entry1.isRedirect() || entry1.getRedirectEntry().getPath() != redirectTarget) {
+        redirectList.add(entry1.getIndex(), redirectTarget);
+      }
+      markCluster(entry1, CHANGED);
+    } else if (entry1.isRedirect()) {
+      // A redirect replaced by an item: the item is new.
+      auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry2.getItem()));
+      zimCreator.addItem(tmpItem);
+    } else {
+      candidates_1.push_back(entry1.getIndex());
+      candidates_2.push_back(entry2.getIndex());
+      markCluster(entry1, UNCHANGED);
+    }
+    ++it_1;
+    ++it_2;
   }
-  zimCreator.addMetadata("redirectlist", redirectList);
+  zimCreator.addMetadata("dlist", dlist.encode(), "application/octet-stream");
+  zimCreator.addMetadata("redirectlist", redirectList.data(), "application/octet-stream");
 
   //StartFileUID
   //contains the UID of the start_file.
-  std::string startFileUID;
-  const auto uuid1 = archive_1.getUuid();
-  const char *s=uuid1.data;
-  for(int i=0;i<16;i++)
-  {
-    startFileUID+=NumberToString((int)s[i]);
-    startFileUID+="\n";
-  }
-  zimCreator.addMetadata("startfileuid", startFileUID);
+  zimCreator.addMetadata("startfileuid", uuidMetadata(archive_1.getUuid()));
 
   //EndFileUID
   //contains the UID of the end_file.
-  std::string endFileUID;
-  const auto uuid2 = archive_2.getUuid();
-  s=uuid2.data;
-  for(int i=0;i<16;i++)
-  {
-    endFileUID+=NumberToString((int)s[i]);
-    endFileUID+="\n";
-  }
-  zimCreator.addMetadata("endfileuid", endFileUID);
+  zimCreator.addMetadata("endfileuid", uuidMetadata(archive_2.getUuid()));
 
   //Metadata article storing the MAIN Article for the new ZIM file.
   std::string mainAurl;
-  try {
+  if (archive_2.hasMainEntry()) {
     mainAurl = archive_2.getMainEntry().getPath();
-  } catch(...) {}
+  }
   zimCreator.addMetadata("mainaurl", mainAurl);
 
-  //Add All articles in file_2 that are not in file_1 and those that are not the same in file_1
-
-  //Articles are added frm file_2.
-  //loop till an article read to be added is found.
-  for(auto& entry2:archive_2.iterByPath())
+  //Add the articles present in both files with a different content.
+  std::cout << "Comparing " << candidates_2.size() << " articles" << std::endl;
+  std::vector<ItemDigest> digests_1, digests_2;
   {
-    try {
-      auto entry1 = archive_1.getEntryByPath(entry2.getPath());
-      if (entry2.isRedirect() || entry1.isRedirect()) {
-        // [FIXME] Handle redirection !!!
-        continue;
-      }
-      if (std::string(entry2.getItem().getData()) != std::string(entry1.getItem().getData())) {
-        auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry2.getItem()));
-        zimCreator.addItem(tmpItem);
-        continue;
-      }
-    } catch(...) { //If the article is not present in FILe 1
-      if (entry2.isRedirect()) {
-        zimCreator.addRedirection(entry2.getPath(), entry2.getTitle(), entry2.getRedirectEntry().getPath());
-      } else {
-        auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry2.getItem()));
-        zimCreator.addItem(tmpItem);
-      }
+    ZIM_TRACE_SCOPE("zimdiff/hashItems");
+    digests_1 = hashItems(archive_1, candidates_1, nbThreads);
+    digests_2 = hashItems(archive_2, candidates_2, nbThreads);
+  }
+  for (size_t i=0; i<candidates_2.size(); i++) {
+    auto entry1 = archive_1.getEntryByPath(candidates_1[i]);
+    auto item2 = archive_2.getEntryByPath(candidates_2[i]).getItem();
+    bool same = digests_1[i] == digests_2[i];
+    if (same && verify) {
+      auto blob1 = entry1.getItem().getData();
+      auto blob2 = item2.getData();
+      same = std::equal(blob1.data(), blob1.end(), blob2.data());
+    }
+    if (!same) {
+      addModifiedItem(zimCreator, entry1, item2, deltaList);
+      markCluster(entry1, CHANGED);
+    }
+  }
+  zimCreator.addMetadata("deltalist", deltaList.encode(), "application/octet-stream");
+
+  //Set of the clusters of start_file whose content is not modified.
+  //zimpatch copies their articles together.
+  Bitset unchangedClusters(clusterStates.size());
+  for (zim::cluster_index_type i=0; i<clusterStates.size(); i++) {
+    if (clusterStates[i] == UNCHANGED) {
+      unchangedClusters.set(i);
+    }
+  }
+  zimCreator.addMetadata("unchangedclusters", unchangedClusters.encode(), "application/octet-stream");
+  zimCreator.finishZimCreation();
+}
+
+// Merge several consecutive diff files in one diff file.
+// The start file of the first diff is needed to resolve the chain.
+void squash(const std::string& start_filename, const std::vector<std::string>& diff_filenames,
+            const std::string& outpath)
+{
+  DiffChain chain(start_filename, diff_filenames);
+  const auto& archive_1 = chain.getStartArchive();
+  const auto& last_diff = chain.getLastDiffArchive();
+
+  zim::writer::Creator zimCreator;
+  zimCreator.startZimCreation(outpath);
+
+  Bitset dlist(archive_1.getAllEntryCount());
+  RedirectListWriter redirectList;
+  Bitset deltaList(archive_1.getAllEntryCount());
+
+  // Add the final version of an entry in the diff file.
+  auto addEntry = [&](zim::entry_index_type pos) {
+    auto entry = chain.getEntry(pos);
+    auto redirectTarget = chain.getRedirectTarget(pos);
+    if (!redirectTarget.empty()) {
+      zimCreator.addRedirection(entry.getPath(), entry.getTitle(), redirectTarget);
+    } else if (!chain.getSource(pos).deltaCount) {
+      auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry.getItem()));
+      zimCreator.addItem(tmpItem);
+    } else {
+      auto item = entry.getItem();
+      zimCreator.addItem(zim::writer::StringItem::create(item.getPath(), chain.getMimetype(pos), item.getTitle(), chain.getContent(pos)));
+    }
+  };
+
+  // Walk the start file and the final entries in path order at the same time.
+  auto range_1 = archive_1.iterByPath();
+  auto it_1 = range_1.begin();
+  zim::entry_index_type pos = 0;
+  while (it_1 != range_1.end() || pos < chain.size()) {
+    int cmp;
+    if (it_1 == range_1.end()) {
+      cmp = 1;
+    } else if (pos == chain.size()) {
+      cmp = -1;
+    } else {
+      cmp = it_1->getPath().compare(chain.getEntry(pos).getPath());
+    }
+
+    if (cmp < 0) {
+      dlist.set(it_1->getIndex());
+      ++it_1;
       continue;
     }
+
+    if (cmp > 0) {
+      addEntry(pos);
+      ++pos;
+      continue;
+    }
+
+    auto& entry1 = *it_1;
+    const auto& source = chain.getSource(pos);
+    auto redirectTarget = chain.getRedirectTarget(pos);
+    if (!redirectTarget.empty()) {
+      if (!entry1.isRedirect() || entry1.getRedirectEntry().getPath() != redirectTarget) {
+        redirectList.add(entry1.getIndex(), redirectTarget);
+      }
+    } else if (source.location() == EntrySource::Location(0, entry1.getIndex()) && !source.deltaCount) {
+      // Unchanged
+    } else if (entry1.isRedirect()) {
+      addEntry(pos);
+    } else if (!source.deltaCount) {
+      addModifiedItem(zimCreator, entry1, chain.getEntry(pos).getItem(), deltaList);
+    } else {
+      auto item = chain.getEntry(pos).getItem();
+      auto content = chain.getContent(pos);
+      auto tmpItem = zim::writer::StringItem::create(item.getPath(), chain.getMimetype(pos), item.getTitle(), content);
+      addModifiedItem(zimCreator, entry1, tmpItem, content.data(), content.size(), deltaList);
+    }
+    ++it_1;
+    ++pos;
   }
+
+  zimCreator.addMetadata("dlist", dlist.encode(), "application/octet-stream");
+  zimCreator.addMetadata("redirectlist", redirectList.data(), "application/octet-stream");
+  zimCreator.addMetadata("deltalist", deltaList.encode(), "application/octet-stream");
+  zimCreator.addMetadata("startfileuid", uuidMetadata(archive_1.getUuid()));
+  zimCreator.addMetadata("endfileuid", last_diff.getMetadata("endfileuid"));
+  zimCreator.addMetadata("mainaurl", last_diff.getMetadata("mainaurl"));
   zimCreator.finishZimCreation();
 }
 
 void usage()
 {
     std::cout<<"\nzimdiff computes a diff_file between two ZIM files, in order to facilitate incremental updates.\n"
-    "\nUsage: zimdiff [start_file] [end_file] [output file]"
-    "\nOption: -v, --version    print software version\n";
+    "\nUsage: zimdiff [options] [start_file] [end_file] [output file]"
+    "\n       zimdiff --squash [start_file] [diff_file]... [output file]"
+    "\n\n--squash merges consecutive diff files, the first one applying on start_file.\n"
+    "\nOptions: -v, --version    print software version"
+    "\n         -j, --threads=N  number of threads used to compare articles (default: 4)"
+    "\n         --verify         compare the content byte by byte when the hashes are equal\n";
     return;
 }
 
 int main(int argc, char* argv[])
 {
-
     //Parsing arguments
-    //There will be only two arguments, so no detailed parsing is required.
-    for (int i=0;i<argc;i++)
+    std::vector<std::string> files;
+    unsigned int nbThreads = 4;
+    bool verify = false;
+    bool squashFlag = false;
+    for (int i=1;i<argc;i++)
     {
-        if(std::string(argv[i])=="-H" ||
-           std::string(argv[i])=="--help" ||
-           std::string(argv[i])=="-h")
+        const std::string arg(argv[i]);
+        if(arg=="-H" ||
+           arg=="--help" ||
+           arg=="-h")
         {
             usage();
             return 0;
         }
 
-        if(std::string(argv[i])=="--version" ||
-           std::string(argv[i])=="-v")
+        if(arg=="--version" ||
+           arg=="-v")
         {
             version();
             return 0;
         }
+
+        if(arg=="--verify")
+        {
+            verify = true;
+        }
+        else if(arg=="--squash")
+        {
+            squashFlag = true;
+        }
+        else if(arg=="-j" && i+1<argc)
+        {
+            nbThreads = atoi(argv[++i]);
+        }
+        else if(arg.compare(0, 10, "--threads=")==0)
+        {
+            nbThreads = atoi(arg.c_str()+10);
+        }
+        else
+        {
+            files.push_back(arg);
+        }
     }
-    if (argc<4)
+    if (files.size()<3)
     {
         std::cout<<"\n[ERROR] Not enough Arguments provided\n";
         usage();
         return -1;
     }
-    std::string filename_1 =argv[1];
-    std::string filename_2 =argv[2];
-    std::string op_file= argv[3];
+    if (nbThreads == 0)
+    {
+        std::cout<<"\n[ERROR] The number of threads must be greater than 0\n";
+        return -1;
+    }
     try
     {
-        create(filename_1, filename_2, op_file);
+        if (squashFlag)
+        {
+            squash(files.front(), std::vector<std::string>(files.begin()+1, files.end()-1), files.back());
+        }
+        else
+        {
+            create(files[0], files[1], files[2], nbThreads, verify);
+        }
     }
     catch (const std::exception& e)
     {
@@ -34,7 +34,15 @@
 #include <vector>
 #include <codecvt>
 #include <unordered_map>
-
+#include <map>
+#include <queue>
+#include <thread>
+#include <algorithm>
+#include <functional>
+
+#include "progress.h"
+#include "tools.h"
+#include "trace.h"
 #include "version.h"
 
 #include <fcntl.h>
@@ -108,25 +116,122 @@ std::string urlEncode(const std::string& value, bool encodeReserved)
   return os.str();
 }
 
+// Accumulate output in a large buffer and hand it to stdout in big chunks.
+// Used by the machine-readable listing where millions of short lines are written.
+class OutputBuffer
+{
+    static const size_t FLUSH_THRESHOLD = 1 << 20;
+    std::string m_buffer;
+
+  public:
+    OutputBuffer()
+    {
+        m_buffer.reserve(FLUSH_THRESHOLD + 4096);
+    }
+
+    ~OutputBuffer()
+    {
+        flush();
+    }
+
+    OutputBuffer& operator<<(char c)
+    {
+        m_buffer += c;
+        return *this;
+    }
+
+    OutputBuffer& operator<<(const char* s)
+    {
+        m_buffer += s;
+        return *this;
+    }
+
+    OutputBuffer& operator<<(const std::string& s)
+    {
+        m_buffer += s;
+        return *this;
+    }
+
+    OutputBuffer& operator<<(uint64_t n)
+    {
+        char digits[20];
+        int i = 0;
+        do {
+            digits[i++] = '0' + (n % 10);
+            n /= 10;
+        } while (n);
+        while (i) {
+            m_buffer += digits[--i];
+        }
+        return *this;
+    }
+
+    // Write a string with `\`, tab and newlines escaped so it fits in one TSV cell.
+    void tsvString(const std::string& s)
+    {
+        for (char c: s) {
+            switch (c) {
+                case '\\': m_buffer += "\\\\"; break;
+                case '\t': m_buffer += "\\t"; break;
+                case '\n': m_buffer += "\\n"; break;
+                case '\r': m_buffer += "\\r"; break;
+                default: m_buffer += c;
+            }
+        }
+    }
+
+    // Write a quoted JSON string.
+    void jsonString(const std::string& s)
+    {
+        ::jsonString(s, m_buffer);
+    }
+
+    void endLine()
+    {
+        m_buffer += '\n';
+        if (m_buffer.size() >= FLUSH_THRESHOLD) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        std::cout.write(m_buffer.data(), m_buffer.size());
+        std::cout.flush();
+        m_buffer.clear();
+    }
+};
+
+enum class ListFormat { TSV, JSONL };
+
 class ZimDumper
 {
     zim::Archive m_archive;
+    std::string m_filename;
     bool verbose;
+    // On stderr, not to mix with the listings.
+    ProgressBar m_progress;
 
   public:
     ZimDumper(const std::string& fname)
       : m_archive(fname),
-        verbose(false)
+        m_filename(fname),
+        verbose(false),
+        m_progress(1, std::cerr)
       { }
 
     void setVerbose(bool sw = true)  { verbose = sw; }
+    void setProgress(bool sw = true)  { m_progress.set_progress_report(sw); }
 
     void printInfo();
+    void printStats(unsigned int nbThreads, unsigned int nbLargest);
     int dumpEntry(const zim::Entry& entry);
     int listEntries(bool info);
     int listEntry(const zim::Entry& entry);
-    void listEntryT(const zim::Entry& entr);
+    void listEntryT(OutputBuffer& out, const zim::Entry& entry, bool details);
+    void listEntryJson(OutputBuffer& out, const zim::Entry& entry, bool details);
     int listEntriesByNamespace(const std::string ns, bool details);
+    int listEntriesFormatted(ListFormat format, bool details, const std::string& ns, const std::string& mimetype);
 
     zim::Entry getEntryByPath(const std::string &path);
     zim::Entry getEntry(zim::size_type idx);
@@ -171,6 +276,321 @@ void ZimDumper::printInfo()
   std::cout.flush();
 }
 
+namespace
+{
+
+uint64_t readLE(const char* data, unsigned int size)
+{
+  uint64_t value = 0;
+  for (unsigned int i = size; i > 0; --i) {
+    value = (value << 8) | static_cast<unsigned char>(data[i-1]);
+  }
+  return value;
+}
+
+// Smallest offset of a dirent greater than `offset` (or UINT64_MAX), read
+// from the path pointer list of the archive.
+uint64_t firstDirentAfter(const std::string& filename, uint64_t pathPtrPos,
+                          uint64_t nbEntries, uint64_t offset)
+{
+  uint64_t first = UINT64_MAX;
+  std::ifstream in(filename, std::ios::binary);
+  in.seekg(pathPtrPos);
+  std::vector<char> buffer(8*4096);
+  while (nbEntries > 0 && in) {
+    const auto count = std::min<uint64_t>(nbEntries, buffer.size()/8);
+    if (!in.read(buffer.data(), count*8)) {
+      break;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+      const auto direntPos = readLE(buffer.data() + i*8, 8);
+      if (direntPos > offset && direntPos < first) {
+        first = direntPos;
+      }
+    }
+    nbEntries -= count;
+  }
+  return first;
+}
+
+// Print min/mean/percentiles and a power-of-two histogram of `values`.
+void printDistribution(const std::string& name, std::vector<uint64_t> values)
+{
+  std::cout << name << ":\n";
+  if (values.empty()) {
+    std::cout << "  -\n";
+    return;
+  }
+  std::sort(values.begin(), values.end());
+  uint64_t sum = 0;
+  for (auto v: values) {
+    sum += v;
+  }
+  auto percentile = [&values](double p) {
+    return values[std::min<size_t>(values.size()-1, size_t(p*values.size()))];
+  };
+  std::cout << "  min: " << values.front()
+            << "  mean: " << sum/values.size()
+            << "  p50: " << percentile(0.5)
+            << "  p90: " << percentile(0.9)
+            << "  p99: " << percentile(0.99)
+            << "  max: " << values.back() << "\n";
+
+  std::map<unsigned int, uint64_t> histogram;
+  for (auto v: values) {
+    unsigned int bucket = 0;
+    while (bucket < 63 && (uint64_t(1) << (bucket+1)) <= v) {
+      bucket++;
+    }
+    histogram[v ? bucket+1 : 0]++;
+  }
+  for (auto& bucket: histogram) {
+    if (bucket.first == 0) {
+      std::cout << "  " << std::setw(20) << "0";
+    } else {
+      std::cout << "  " << std::setw(20) << (">= " + std::to_string(uint64_t(1) << (bucket.first-1)));
+    }
+    std::cout << ": " << bucket.second << "\n";
+  }
+}
+
+// Statistics gathered by one worker. Merged by `ZimDumper::printStats`.
+struct PartialStats
+{
+  typedef std::pair<zim::size_type, zim::entry_index_type> SizedEntry;
+
+  uint64_t nbItems = 0;
+  uint64_t nbRedirects = 0;
+  uint64_t direntBytes = 0;
+  std::vector<uint64_t> clusterSizes;
+  std::vector<uint32_t> clusterItems;
+  std::vector<uint8_t> clusterInfos;
+  std::map<std::string, std::pair<uint64_t, uint64_t>> mimetypes;
+  std::map<unsigned int, uint64_t> redirectDepths;
+  // Min-heap, so the smallest of the largest items is on top.
+  std::priority_queue<SizedEntry, std::vector<SizedEntry>, std::greater<SizedEntry>> largest;
+};
+
+} // unnamed namespace
+
+void ZimDumper::printStats(unsigned int nbThreads, unsigned int nbLargest)
+{
+  const zim::entry_index_type nbEntries = m_archive.getEntryCount();
+  const zim::cluster_index_type nbClusters = m_archive.getClusterCount();
+  const bool newNamespace = m_archive.hasNewNamespaceScheme();
+
+  // The cluster offsets are not stored in order, sort them to know where each
+  // cluster ends.
+  std::vector<std::pair<zim::offset_type, zim::cluster_index_type>> offsets;
+  for (zim::cluster_index_type i = 0; i < nbClusters; ++i) {
+    offsets.push_back(std::make_pair(m_archive.getClusterOffset(i), i));
+  }
+  std::sort(offsets.begin(), offsets.end());
+
+  // Raw header fields are only read for single part archives.
+  char header[80];
+  bool haveHeader = false;
+  if (!m_archive.isMultiPart()) {
+    std::ifstream in(m_filename, std::ios::binary);
+    haveHeader = bool(in.read(header, sizeof(header)));
+  }
+  // The last cluster ends where the next part of the archive starts. In a
+  // libzim 7 file the dirents and the pointer lists are after the clusters,
+  // in older files they are before and the clusters end at the checksum.
+  zim::offset_type clustersEnd = m_archive.getFilesize();
+  if (haveHeader && !offsets.empty()) {
+    const auto lastCluster = offsets.back().first;
+    const std::vector<uint64_t> parts = {
+      readLE(header+32, 8),  // pathPtrPos
+      readLE(header+40, 8),  // titlePtrPos
+      readLE(header+48, 8),  // clusterPtrPos
+      readLE(header+56, 8),  // mimeListPos
+      readLE(header+72, 8),  // checksumPos
+      firstDirentAfter(m_filename, readLE(header+32, 8), readLE(header+24, 4), lastCluster)
+    };
+    for (auto part: parts) {
+      if (part > lastCluster && part < clustersEnd) {
+        clustersEnd = part;
+      }
+    }
+  }
+
+  std::vector<uint64_t> compressedSizes(nbClusters, 0);
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    const auto end = i+1 < offsets.size() ? offsets[i+1].first : clustersEnd;
+    compressedSizes[offsets[i].second] = end > offsets[i].first ? end - offsets[i].first : 0;
+  }
+
+  nbThreads = std::max(1U, nbThreads);
+  m_progress.reset(nbEntries);
+  std::vector<PartialStats> partials(nbThreads);
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < nbThreads; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      auto& stats = partials[t];
+      stats.clusterSizes.resize(nbClusters, 0);
+      stats.clusterItems.resize(nbClusters, 0);
+      stats.clusterInfos.resize(nbClusters, 0);
+
+      // Each worker reads the info byte of a slice of the clusters...
+      if (haveHeader) {
+        std::ifstream in(m_filename, std::ios::binary);
+        for (auto i = zim::cluster_index_type(uint64_t(nbClusters)*t/nbThreads);
+             i < zim::cluster_index_type(uint64_t(nbClusters)*(t+1)/nbThreads);
+             ++i) {
+          char info = 0;
+          in.seekg(offsets[i].first);
+          in.read(&info, 1);
+          stats.clusterInfos[offsets[i].second] = info;
+        }
+      }
+
+      // ... and walks a slice of the entries in cluster order, so the
+      // cluster of the items (read to get their size) is read once.
+      const auto first = zim::entry_index_type(uint64_t(nbEntries)*t/nbThreads);
+      const auto last = zim::entry_index_type(uint64_t(nbEntries)*(t+1)/nbThreads);
+      for (auto order = first; order < last; ++order) {
+        auto entry = m_archive.getEntryByClusterOrder(order);
+        const auto idx = entry.getIndex();
+        m_progress.report();
+        const auto path = entry.getPath();
+        const auto title = entry.getTitle();
+        const size_t urlSize = newNamespace ? path.size() : path.size() - 2;
+        const size_t titleSize = title == path ? 0 : title.size();
+
+        if (entry.isRedirect()) {
+          stats.nbRedirects++;
+          stats.direntBytes += 12 + urlSize + 1 + titleSize + 1;
+          unsigned int depth = 1;
+          auto target = entry.getRedirectEntry();
+          // Stop on (invalid) redirection loops.
+          while (target.isRedirect() && depth < 64) {
+            target = target.getRedirectEntry();
+            depth++;
+          }
+          stats.redirectDepths[depth]++;
+          continue;
+        }
+
+        stats.nbItems++;
+        stats.direntBytes += 16 + urlSize + 1 + titleSize + 1;
+        auto item = entry.getItem();
+        const auto size = item.getSize();
+        const auto cluster = item.getClusterIndex();
+        if (cluster < nbClusters) {
+          stats.clusterSizes[cluster] += size;
+          stats.clusterItems[cluster]++;
+        }
+        auto& mimetype = stats.mimetypes[item.getMimetype()];
+        mimetype.first++;
+        mimetype.second += size;
+        if (nbLargest) {
+          if (stats.largest.size() < nbLargest) {
+            stats.largest.push(std::make_pair(size, idx));
+          } else if (stats.largest.top().first < size) {
+            stats.largest.pop();
+            stats.largest.push(std::make_pair(size, idx));
+          }
+        }
+      }
+    }));
+  }
+  for (auto& worker: workers) {
+    worker.join();
+  }
+  m_progress.finish();
+
+  // Merge
+  PartialStats total;
+  total.clusterSizes.resize(nbClusters, 0);
+  total.clusterItems.resize(nbClusters, 0);
+  total.clusterInfos.resize(nbClusters, 0);
+  std::vector<PartialStats::SizedEntry> largest;
+  for (auto& stats: partials) {
+    total.nbItems += stats.nbItems;
+    total.nbRedirects += stats.nbRedirects;
+    total.direntBytes += stats.direntBytes;
+    for (zim::cluster_index_type i = 0; i < nbClusters; ++i) {
+      total.clusterSizes[i] += stats.clusterSizes[i];
+      total.clusterItems[i] += stats.clusterItems[i];
+      total.clusterInfos[i] |= stats.clusterInfos[i];
+    }
+    for (auto& mimetype: stats.mimetypes) {
+      total.mimetypes[mimetype.first].first += mimetype.second.first;
+      total.mimetypes[mimetype.first].second += mimetype.second.second;
+    }
+    for (auto& depth: stats.redirectDepths) {
+      total.redirectDepths[depth.first] += depth.second;
+    }
+    while (!stats.largest.empty()) {
+      largest.push_back(stats.largest.top());
+      stats.largest.pop();
+    }
+  }
+  std::sort(largest.rbegin(), largest.rend());
+  if (largest.size() > nbLargest) {
+    largest.resize(nbLargest);
+  }
+
+  std::cout << "entries: " << nbEntries
+            << " (items: " << total.nbItems << ", redirects: " << total.nbRedirects << ")\n";
+  std::cout << "clusters: " << nbClusters << "\n";
+  if (haveHeader) {
+    std::map<std::string, std::pair<uint64_t, uint64_t>> compressions;
+    for (zim::cluster_index_type i = 0; i < nbClusters; ++i) {
+      auto& compression = compressions[compressionName(total.clusterInfos[i])];
+      compression.first++;
+      compression.second += compressedSizes[i];
+    }
+    std::cout << "cluster compression:\n";
+    for (auto& compression: compressions) {
+      std::cout << "  " << std::setw(8) << compression.first << ": "
+                << compression.second.first << " clusters, "
+                << compression.second.second << " bytes\n";
+    }
+  } else {
+    std::cout << "cluster compression: - (multi-part archive)\n";
+  }
+  printDistribution("compressed cluster size", compressedSizes);
+  printDistribution("uncompressed cluster size",
+                    std::vector<uint64_t>(total.clusterSizes.begin(), total.clusterSizes.end()));
+  printDistribution("items per cluster",
+                    std::vector<uint64_t>(total.clusterItems.begin(), total.clusterItems.end()));
+
+  std::vector<std::pair<uint64_t, std::string>> mimetypes;
+  for (auto& mimetype: total.mimetypes) {
+    mimetypes.push_back(std::make_pair(mimetype.second.second, mimetype.first));
+  }
+  std::sort(mimetypes.rbegin(), mimetypes.rend());
+  std::cout << "bytes per mimetype:\n";
+  for (auto& mimetype: mimetypes) {
+    std::cout << "  " << std::setw(14) << mimetype.first << " "
+              << std::setw(10) << total.mimetypes[mimetype.second].first << " items  "
+              << mimetype.second << "\n";
+  }
+
+  std::cout << "largest items:\n";
+  for (auto& item: largest) {
+    std::cout << "  " << std::setw(14) << item.first << " "
+              << m_archive.getEntryByPath(item.second).getPath() << "\n";
+  }
+
+  std::cout << "redirect chain depth:\n";
+  for (auto& depth: total.redirectDepths) {
+    std::cout << "  " << std::setw(4) << depth.first << ": " << depth.second << "\n";
+  }
+
+  std::cout << "index sizes:\n"
+            << "  dirents:          " << total.direntBytes << "\n";
+  if (haveHeader) {
+    const auto nbAllEntries = readLE(header+24, 4);
+    std::cout << "  path pointers:    " << nbAllEntries*8 << "\n"
+              << "  title index:      " << nbAllEntries*4 << "\n"
+              << "  cluster pointers: " << uint64_t(nbClusters)*8 << "\n";
+  }
+  std::cout << std::flush;
+}
+
 int ZimDumper::dumpEntry(const zim::Entry& entry)
 {
     if (entry.isRedirect()) {
@@ -185,13 +605,17 @@ int ZimDumper::dumpEntry(const zim::Entry& entry)
 int ZimDumper::listEntries(bool info)
 {
     int ret = 0;
+    m_progress.reset(m_archive.getEntryCount());
     for (auto& entry:m_archive.iterByPath()) {
+        m_progress.report();
         if (info) {
           ret = listEntry(entry);
         } else {
           std::cout << entry.getPath() << '\n';
         }
      }
+    std::cout << std::flush;
+    m_progress.finish();
     return ret;
 }
 
@@ -216,33 +640,88 @@ int ZimDumper::listEntry(const zim::Entry& entry)
   return 0;
 }
 
-void ZimDumper::listEntryT(const zim::Entry& entry)
+void ZimDumper::listEntryT(OutputBuffer& out, const zim::Entry& entry, bool details)
 {
-  std::cout << entry.getPath()
-    << '\t' << entry.getTitle()
-    << '\t' << entry.getIndex()
-    << '\t' << (entry.isRedirect()?'R':'A');
+  out.tsvString(entry.getPath());
+  out << '\t';
+  out.tsvString(entry.getTitle());
+  out << '\t' << uint64_t(entry.getIndex())
+      << '\t' << (entry.isRedirect()?'R':'A');
 
   if (entry.isRedirect()) {
-    std::cout << '\t' << entry.getRedirectEntry().getIndex();
+    out << '\t' << uint64_t(entry.getRedirectEntry().getIndex());
   } else {
     auto item = entry.getItem();
-    std::cout << '\t' << item.getMimetype()
-              << '\t' << item.getSize();
+    out << '\t';
+    out.tsvString(item.getMimetype());
+    // The size needs the cluster to be read, only get it if asked for.
+    if (details) {
+      out << '\t' << uint64_t(item.getSize());
+    }
   }
-  std::cout << std::endl;
+  out.endLine();
+}
+
+void ZimDumper::listEntryJson(OutputBuffer& out, const zim::Entry& entry, bool details)
+{
+  out << "{\"path\":";
+  out.jsonString(entry.getPath());
+  out << ",\"title\":";
+  out.jsonString(entry.getTitle());
+  out << ",\"idx\":" << uint64_t(entry.getIndex());
+
+  if (entry.isRedirect()) {
+    out << ",\"type\":\"redirect\",\"redirect\":" << uint64_t(entry.getRedirectEntry().getIndex());
+  } else {
+    auto item = entry.getItem();
+    out << ",\"type\":\"item\",\"mimetype\":";
+    out.jsonString(item.getMimetype());
+    if (details) {
+      out << ",\"size\":" << uint64_t(item.getSize());
+    }
+  }
+  out << '}';
+  out.endLine();
+}
+
+int ZimDumper::listEntriesFormatted(ListFormat format, bool details, const std::string& ns, const std::string& mimetype)
+{
+    OutputBuffer out;
+    // Both ranges walk the dirents in path (index) order.
+    auto range = ns.empty() ? m_archive.iterByPath() : m_archive.findByPath(ns);
+    m_progress.reset(range.size());
+    for (auto& entry:range) {
+        m_progress.report();
+        if (!mimetype.empty()) {
+            if (entry.isRedirect() || entry.getItem().getMimetype() != mimetype) {
+                continue;
+            }
+        }
+        if (format == ListFormat::TSV) {
+            listEntryT(out, entry, details);
+        } else {
+            listEntryJson(out, entry, details);
+        }
+    }
+    m_progress.finish();
+    return 0;
 }
 
 int ZimDumper::listEntriesByNamespace(const std::string ns, bool details)
 {
     int ret = 0;
-    for (auto& entry:m_archive.findByPath(ns)) {
+    auto range = m_archive.findByPath(ns);
+    m_progress.reset(range.size());
+    for (auto& entry:range) {
+        m_progress.report();
         if (details) {
           ret = listEntry(entry);
         } else {
           std::cout << entry.getPath() << '\n';
         }
     }
+    std::cout << std::flush;
+    m_progress.finish();
     return ret;
 }
 
@@ -305,6 +784,7 @@ inline void write_to_file(const std::string &base, const std::string& path, cons
 
 void ZimDumper::dumpFiles(const std::string& directory, bool symlinkdump, std::function<bool (const char c)> nsfilter)
 {
+  ZIM_TRACE_SCOPE("dumpFiles");
   unsigned int truncatedFiles = 0;
 #if defined(_WIN32)
     std::wstring wdir = converter.from_bytes(directory);
@@ -314,7 +794,9 @@ void ZimDumper::dumpFiles(const std::string& directory, bool symlinkdump, std::f
 #endif
 
   std::vector<std::string> pathcache;
+  m_progress.reset(m_archive.getEntryCount());
   for (auto& entry:m_archive.iterEfficient()) {
+    ZIM_TRACE_SCOPE("dumpFiles/entry");
     std::string path = entry.getPath();
     std::string dir = "";
     std::string filename = path;
@@ -342,6 +824,7 @@ void ZimDumper::dumpFiles(const std::string& directory, bool symlinkdump, std::f
     std::string full_path = directory + SEPARATOR + relative_path;
 
     if (entry.isRedirect()) {
+        m_progress.report();
         auto redirectItem = entry.getItem(true);
         std::string redirectPath = redirectItem.getPath();
         if (symlinkdump == false && redirectItem.getMimetype() == "text/html") {
@@ -365,9 +848,12 @@ void ZimDumper::dumpFiles(const std::string& directory, bool symlinkdump, std::f
         }
     } else {
       auto blob = entry.getItem().getData();
+      ZIM_TRACE_COUNT("dumpFiles/bytes", blob.size());
       write_to_file(directory + SEPARATOR, relative_path, blob.data(), blob.size());
+      m_progress.report(blob.size());
     }
   }
+  m_progress.finish();
 }
 
 static const char USAGE[] =
@@ -375,10 +861,12 @@ R"(
 zimdump tool is used to inspect a zim file and also to dump its contents into the filesystem.
 
 Usage:
-  zimdump list [--details] [--idx=INDEX|([--url=URL] [--ns=N])] [--] <file>
-  zimdump dump --dir=DIR [--ns=N] [--redirect] [--] <file>
+  zimdump list [--details] [--idx=INDEX|([--url=URL] [--ns=N])] [--progress] [--] <file>
+  zimdump list --format=FORMAT [--details] [--ns=N] [--mime=MIMETYPE] [--progress] [--] <file>
+  zimdump dump --dir=DIR [--ns=N] [--redirect] [--progress] [--] <file>
   zimdump show (--idx=INDEX|(--url=URL [--ns=N])) [--] <file>
   zimdump info [--ns=N] [--] <file>
+  zimdump stats [--threads=N] [--largest=N] [--progress] [--] <file>
   zimdump -h | --help
   zimdump --version
 
@@ -391,8 +879,16 @@ Selectors:
 
 Options:
   --details    Show details about the articles. Else, list only the url of the article(s).
+               With `--format`, add the item size (this needs to read the clusters).
+  --format=FORMAT  List all entries in a machine-readable format, one entry per line:
+               `tsv` (path, title, index, R|A, redirect index or mimetype[, size])
+               or `jsonl` (one json object per entry).
+  --mime=MIMETYPE  With `--format`, list only the items of this mimetype.
   --dir=DIR    Directory where to dump the article(s) content.
   --redirect   Use symlink to dump redirect articles. Else create html redirect file
+  --threads=N  Number of threads used to compute the statistics. Default to the number of cores.
+  --largest=N  Number of largest items to report in the statistics [default: 10].
+  --progress   Print the progress of list, dump and stats on the standard error.
   -h, --help   Show this help
   --version    Show zimdump version.
 
@@ -409,6 +905,16 @@ int subcmdInfo(ZimDumper &app, std::map<std::string, docopt::value> &args)
     return 0;
 }
 
+int subcmdStats(ZimDumper &app, std::map<std::string, docopt::value> &args)
+{
+    unsigned int nbThreads = std::thread::hardware_concurrency();
+    if (args["--threads"]) {
+        nbThreads = args["--threads"].asLong();
+    }
+    app.printStats(nbThreads, args["--largest"].asLong());
+    return 0;
+}
+
 int subcmdDumpAll(ZimDumper &app, const std::string &outdir, bool redirect, std::function<bool (const char c)> nsfilter)
 {
 #ifdef _WIN32
@@ -464,6 +970,23 @@ int subcmdList(ZimDumper &app, std::map<std::string, docopt::value> &args)
     bool details = args["--details"].asBool();
     bool ns(args["--ns"]);
 
+    if (args["--format"]) {
+        const auto format = args["--format"].asString();
+        ListFormat listFormat;
+        if (format == "tsv") {
+            listFormat = ListFormat::TSV;
+        } else if (format == "jsonl") {
+            listFormat = ListFormat::JSONL;
+        } else {
+            std::cerr << "Unknown format " << format << " (must be tsv or jsonl)" << std::endl;
+            return -1;
+        }
+        return app.listEntriesFormatted(listFormat,
+                                        details,
+                                        ns ? args["--ns"].asString() : "",
+                                        args["--mime"] ? args["--mime"].asString() : "");
+    }
+
     if (idx || url) {
         try {
             // docopt guaranty us that we have `--idx` or `--url` (or nothing, but not both)
@@ -495,9 +1018,11 @@ int main(int argc, char* argv[])
 
     try {
         ZimDumper app(args["<file>"].asString());
+        app.setProgress(args["--progress"].asBool());
 
         std::unordered_map<std::string, std::function<int(ZimDumper&, decltype(args)&)>> dispatchtable = {
             {"info",            subcmdInfo },
+            {"stats",           subcmdStats },
             {"dump",            subcmdDump },
             {"list",            subcmdList },
             {"show",            subcmdShow }
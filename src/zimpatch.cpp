@@ -17,6 +17,8 @@
  * MA 02110-1301, USA.
  */
 
+#define ZIM_PRIVATE
+
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -30,8 +32,14 @@
 #include <list>
 #include <limits>
 #include <algorithm>
+#include <chrono>
+
+#include <getopt.h>
 
 #include "tools.h"
+#include "diffchain.h"
+#include "progress.h"
+#include "trace.h"
 #include "version.h"
 
 std::string NumberToString(int number)
@@ -41,30 +49,17 @@ std::string NumberToString(int number)
   return ss.str();
 }
 
-bool isAdditionalMetadata(std::string url)
-{
-   if(url=="M/dlist")
-       return true;
-   if(url=="M/startfileuid")
-       return true;
-   if(url=="M/endfileuid")
-       return true;
-   if(url=="M/mainaurl")
-       return true;
-   if(url=="M/layoutaurl")
-       return true;
-   if(url=="M/redirectlist")
-       return true;
-   return false;
-}
-
-void create(const std::string& start_filename, const std::string& diff_filename, const std::string& out_filename)
+void create(const std::string& start_filename, const std::string& diff_filename, const std::string& out_filename,
+            unsigned int threads, bool zstdFlag)
 {
+  ZIM_TRACE_SCOPE("zimpatch/create");
   zim::Archive start_archive(start_filename);
   zim::Archive diff_archive(diff_filename);
 
   zim::writer::Creator zimCreator;
-  zimCreator.configMinClusterSize(2048);
+  zimCreator.configMinClusterSize(2048)
+            .configNbWorkers(threads)
+            .configCompression(zstdFlag ? zim::zimcompZstd : zim::zimcompLzma);
   zimCreator.startZimCreation(out_filename);
 
   std::string id=diff_archive.getMetadata("endfileuid");
@@ -94,111 +89,202 @@ void create(const std::string& start_filename, const std::string& diff_filename,
      zimCreator.setMainPath(mainPath);
   }
 
-  std::string tmp="";
-  std::vector<std::string> rdlist;
-  std::map<std::string, std::string> redirectList;
-  std::string tempString=diff_archive.getMetadata("redirectlist");
-  for(unsigned int i=0;i<tempString.size();i++) {
-    if(tempString[i]!='\n') {
-      tmp+=tempString[i];
-    } else {
-      rdlist.push_back(tmp);
-      tmp="";
-    }
-  }
+  //Process dlist.
+  std::cout<<"\nProcessing Delete list..\n"<<std::flush;
+  const auto lookup = archiveLookup(start_archive);
+  const auto dlist = readEntrySet(diff_archive, "dlist", start_archive.getAllEntryCount(), lookup);
+  const auto redirectData = readRedirectList(diff_archive, lookup);
+  RedirectListReader redirectList(redirectData.data(), redirectData.size());
 
-  for(unsigned i=0;i<rdlist.size();i=i+2) {
-    redirectList[rdlist[i]] = rdlist[i+1];
+  //Process the set of unchanged clusters.
+  //Their articles are added first, in cluster order, so each of these clusters
+  //is read once and their articles stay together in the new file.
+  const auto clusterData = getOptionalMetadata(diff_archive, "unchangedclusters");
+  Bitset unchangedClusters;
+  if (!clusterData.empty()) {
+    unchangedClusters = Bitset::decode(clusterData.data(), clusterData.size());
   }
 
-  std::string dllist = diff_archive.getMetadata("dlist");
-  tmp="";
-  std::vector<std::string> delete_list;
-  //Computing list of deleted articles and storing them in a vector.
-  for(unsigned int i=0; i<dllist.size(); i++) {
-    if(dllist[i]!='\n') {
-      tmp+=dllist[i];
-    } else {
-      delete_list.push_back(tmp);
-      tmp="";
+  std::vector<bool> alreadyAdded(start_archive.getAllEntryCount(), false);
+  if (unchangedClusters.size()) {
+    std::cout<<"\nCopying unchanged clusters..\n"<<std::flush;
+    ZIM_TRACE_SCOPE("zimpatch/unchangedClusters");
+    for (auto& entry:start_archive.iterEfficient()) {
+      if (entry.isRedirect() || dlist.test(entry.getIndex())) {
+        continue;
+      }
+      auto item = entry.getItem();
+      if (!unchangedClusters.test(item.getClusterIndex())) {
+        continue;
+      }
+      auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(item));
+      zimCreator.addItem(tmpItem);
+      alreadyAdded[entry.getIndex()] = true;
     }
   }
 
-  //Process dlist.
-  std::cout<<"\nProcessing Delete list..\n"<<std::flush;
-  std::vector< int > dlist;
-  dlist.resize(start_archive.getEntryCount()+diff_archive.getEntryCount());
-  for(unsigned int i=0;i<dlist.size();i++) {
-    dlist[i]=0;
-  }
+  //Process the set of articles stored as a delta.
+  const auto deltaList = readEntrySet(diff_archive, "deltalist", start_archive.getAllEntryCount(), lookup);
+  unsigned int deltaCount = 0;
+  zim::size_type deltaInputSize = 0;
+  zim::size_type deltaOutputSize = 0;
+  std::chrono::steady_clock::duration deltaDuration(0);
 
-  for(unsigned int i=0;i<delete_list.size();i++) {
-    //Deleted articles will always be present in the start_file only.
-    dlist[start_archive.getEntryByPath(delete_list[i]).getIndex()]=1;
-  }
+  // Apply a delta of the diff file on the article of file_1.
+  auto addDeltaItem = [&](const zim::Entry& startEntry, const zim::Entry& diffEntry) {
+    ZIM_TRACE_SCOPE("zimpatch/applyDelta");
+    auto item = diffEntry.getItem();
+    auto source = startEntry.getItem().getData();
+    auto delta = item.getData();
+    const auto start = std::chrono::steady_clock::now();
+    auto content = applyDelta(source.data(), source.size(), delta.data(), delta.size());
+    deltaDuration += std::chrono::steady_clock::now() - start;
+    deltaCount++;
+    deltaInputSize += delta.size();
+    deltaOutputSize += content.size();
+    ZIM_TRACE_COUNT("zimpatch/deltaBytes", delta.size());
+    // The delta is stored as "application/octet-stream", the mimetype is
+    // the one of the source.
+    zimCreator.addItem(zim::writer::StringItem::create(item.getPath(), startEntry.getItem().getMimetype(), item.getTitle(), content));
+  };
 
-  delete_list.clear();
+  auto addEntry = [&](const zim::Entry& entry) {
+    if (entry.isRedirect()) {
+      zimCreator.addRedirection(entry.getPath(), entry.getTitle(), entry.getRedirectEntry().getPath());
+    } else {
+      auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry.getItem()));
+      zimCreator.addItem(tmpItem);
+    }
+  };
 
-  //Add all articles in File_1 that have not ben deleted.
-  std::string url="";
-  for (unsigned int index = 0; index < start_archive.getEntryCount(); index++) {
-    auto entry=start_archive.getEntryByPath(index);
-    if(dlist[index]==1) {
-      continue;
+  //Walk file_1 and the diff_file in path order at the same time.
+  std::cout<<"\nAdding articles..\n"<<std::flush;
+  ProgressBar progress(1);
+  progress.reset(start_archive.getEntryCount() + diff_archive.getEntryCount());
+  progress.set_progress_report(true);
+  auto startRange = start_archive.iterByPath();
+  auto diffRange = diff_archive.iterByPath();
+  auto startIt = startRange.begin();
+  auto diffIt = diffRange.begin();
+  while (startIt != startRange.end() || diffIt != diffRange.end()) {
+    ZIM_TRACE_SCOPE("zimpatch/entry");
+    int cmp;
+    if (startIt == startRange.end()) {
+      cmp = 1;
+    } else if (diffIt == diffRange.end()) {
+      cmp = -1;
+    } else {
+      cmp = startIt->getPath().compare(diffIt->getPath());
     }
 
-    //If the article is also present in file_2
-    try {
-      entry = diff_archive.getEntryByPath(entry.getPath());
-    } catch(...) {}
+    if (cmp > 0) {
+      //New article in file_2.
+      if (!isAdditionalMetadata(diffIt->getPath())) {
+        addEntry(*diffIt);
+      }
+      ++diffIt;
+      progress.report();
+      continue;
+    }
 
-    try {
+    //Article of file_1, maybe also present in the diff_file.
+    auto& startEntry = *startIt;
+    const auto index = startEntry.getIndex();
+    if (dlist.test(index) || alreadyAdded[index]) {
+      // Deleted or already added.
+    } else if (redirectList.seek(index)) {
       // entry has been replace by a redirect in new zim file.
-      auto redirectPath = redirectList.at(entry.getPath());
-      zimCreator.addRedirection(entry.getPath(), entry.getTitle(), redirectPath);
-      continue;
-    } catch (...) {
-      if (entry.isRedirect()) {
-        zimCreator.addRedirection(entry.getPath(), entry.getTitle(), entry.getRedirectEntry().getPath());
-      } else {
-        auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry.getItem()));
-        zimCreator.addItem(tmpItem);
-      }
+      zimCreator.addRedirection(startEntry.getPath(), startEntry.getTitle(), redirectList.target());
+    } else if (cmp < 0) {
+      addEntry(startEntry);
+    } else if (!diffIt->isRedirect() && deltaList.test(index)) {
+      // The diff file contains a delta against the article of file_1.
+      addDeltaItem(startEntry, *diffIt);
+    } else {
+      addEntry(*diffIt);
     }
-  }
 
-  //Now adding new articles in file_2
-  for (unsigned int index =0; index<+diff_archive.getEntryCount(); index++) {
-    auto entry=diff_archive.getEntryByPath(index);
+    ++startIt;
+    progress.report();
+    if (cmp == 0) {
+      ++diffIt;
+      progress.report();
+    }
+  }
+  progress.finish();
 
-    //If the article is already in file_1, it has been added.
-    if(start_archive.hasEntryByPath(entry.getPath())||isAdditionalMetadata(entry.getPath())) {
-      continue;
+  if (deltaCount) {
+    const double seconds = std::chrono::duration<double>(deltaDuration).count();
+    std::cout<<"\nApplied "<<deltaCount<<" deltas ("<<deltaInputSize<<" bytes of delta, "
+             <<deltaOutputSize<<" bytes of content) in "<<seconds<<"s";
+    if (seconds > 0) {
+      std::cout<<" ("<<deltaOutputSize/seconds/1024/1024<<" MB/s)";
     }
+    std::cout<<"\n"<<std::flush;
+  }
 
-    try {
-      // entry has been replace by a redirect in new zim file.
-      auto redirectPath = redirectList.at(entry.getPath());
-      zimCreator.addRedirection(entry.getPath(), entry.getTitle(), redirectPath);
-      continue;
-    } catch(...) {
-      if (entry.isRedirect()) {
-        zimCreator.addRedirection(entry.getPath(), entry.getTitle(), entry.getRedirectEntry().getPath());
-      } else {
-        auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry.getItem()));
-        zimCreator.addItem(tmpItem);
-      }
+  std::cout<<"\nWriting the new file..\n"<<std::flush;
+  zimCreator.finishZimCreation();
+}
+
+// Apply several diff files at once: the final state of every entry is
+// resolved first, then the new file is created in one pass.
+void createFromChain(const std::string& start_filename, const std::vector<std::string>& diff_filenames,
+                     const std::string& out_filename, unsigned int threads, bool zstdFlag)
+{
+  std::cout<<"\nResolving the chain of diff files..\n"<<std::flush;
+  DiffChain chain(start_filename, diff_filenames);
+  const auto& last_diff = chain.getLastDiffArchive();
+
+  zim::writer::Creator zimCreator;
+  zimCreator.configMinClusterSize(2048)
+            .configNbWorkers(threads)
+            .configCompression(zstdFlag ? zim::zimcompZstd : zim::zimcompLzma);
+  zimCreator.startZimCreation(out_filename);
+
+  const auto uuid = readUuidMetadata(last_diff, "endfileuid");
+  zimCreator.setUuid(zim::Uuid(uuid.data()));
+
+  auto mainPath = last_diff.getMetadata("mainaurl");
+  zim::entry_index_type mainPos;
+  if(chain.findEntry(mainPath, mainPos)) {
+     zimCreator.setMainPath(mainPath);
+  }
+
+  std::cout<<"\nAdding articles..\n"<<std::flush;
+  ProgressBar progress(1);
+  progress.reset(chain.size());
+  progress.set_progress_report(true);
+  for (zim::entry_index_type pos = 0; pos < chain.size(); pos++) {
+    auto entry = chain.getEntry(pos);
+    auto redirectTarget = chain.getRedirectTarget(pos);
+    if (!redirectTarget.empty()) {
+      zimCreator.addRedirection(entry.getPath(), entry.getTitle(), redirectTarget);
+    } else if (!chain.getSource(pos).deltaCount) {
+      auto tmpItem = std::shared_ptr<zim::writer::Item>(new CopyItem(entry.getItem()));
+      zimCreator.addItem(tmpItem);
+    } else {
+      auto item = entry.getItem();
+      zimCreator.addItem(zim::writer::StringItem::create(item.getPath(), chain.getMimetype(pos), item.getTitle(), chain.getContent(pos)));
     }
+    progress.report();
   }
+  progress.finish();
 
+  std::cout<<"\nWriting the new file..\n"<<std::flush;
   zimCreator.finishZimCreation();
 }
 
 void usage()
 {
     std::cout<<"\nzimpatch computes the end_file using a start_file and a diff_file (made by zimdiff).\n"
-      "\nUsage: zimpatch [start_file] [diff_file] [output file]"
-      "\nOption: -v, --version    print software version\n";
+      "\nUsage: zimpatch [options] [start_file] [diff_file]... [output file]"
+      "\n\nSeveral diff files can be given, to be applied in order. The final file"
+      "\nis then created in one pass, without creating the intermediate files.\n"
+      "\nOptions: -v, --version    print software version"
+      "\n         -h, --help       print this help"
+      "\n         -J, --threads    count of threads to utilize (default: 4)"
+      "\n         -z, --zstd       use Zstandard as ZIM compression (lzma otherwise)\n";
     return;
 }
 
@@ -259,41 +345,69 @@ bool checkDiffFile(std::string startFileName, std::string diffFileName)
 
 int main(int argc, char* argv[])
 {
-    // Parsing arguments. There will be only three arguments, so no
-    // detailed parsing is required.
-    for(int i=0; i<argc; i++)
+    static struct option long_options[]
+        = {{"help", no_argument, 0, 'h'},
+           {"version", no_argument, 0, 'v'},
+           {"threads", required_argument, 0, 'J'},
+           {"zstd", no_argument, 0, 'z'},
+           {0, 0, 0, 0}};
+    int threads = 4;
+    bool zstdFlag = false;
+    int option_index = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "hHvJ:z", long_options, &option_index)) != -1)
     {
-        if(std::string(argv[i])=="-H" ||
-           std::string(argv[i])=="--help" ||
-           std::string(argv[i])=="-h")
-        {
-            usage();
-            return 0;
-        }
-
-        if(std::string(argv[i])=="--version" ||
-           std::string(argv[i])=="-v")
+        switch (c)
         {
-            version();
-            return 0;
+            case 'h':
+            case 'H':
+                usage();
+                return 0;
+            case 'v':
+                version();
+                return 0;
+            case 'J':
+                threads = atoi(optarg);
+                break;
+            case 'z':
+                zstdFlag = true;
+                break;
+            default:
+                usage();
+                return -1;
         }
     }
-    if(argc<4)
+    if(argc-optind<3)
     {
         std::cout<<"\n[ERROR] Not enough Arguments provided\n";
         usage();
         return -1;
     }
+    if(threads<1)
+    {
+        std::cout<<"\n[ERROR] The number of threads must be greater than 0\n";
+        return -1;
+    }
 
-    //Strings containing the filenames of the start_file, diff_file and end_file.
-    std::string start_filename =argv[1];
-    std::string diff_filename =argv[2];
-    std::string end_filename= argv[3];
+    //Strings containing the filenames of the start_file, diff_files and end_file.
+    std::string start_filename =argv[optind];
+    std::vector<std::string> diff_filenames(argv+optind+1, argv+argc-1);
+    std::string end_filename= argv[argc-1];
     std::cout<<"\nStart File: "<<start_filename;
-    std::cout<<"\nDiff File: "<<diff_filename;
+    for (auto& diff_filename:diff_filenames)
+    {
+        std::cout<<"\nDiff File: "<<diff_filename;
+    }
     std::cout<<"\nEnd File: "<<end_filename<<"\n";
     try
     {
+        if(diff_filenames.size()>1)
+        {
+            createFromChain(start_filename, diff_filenames, end_filename, threads, zstdFlag);
+            return 0;
+        }
+
+        const auto& diff_filename = diff_filenames.front();
         //Callling zimwriter to create the diff_file
         if(!checkDiffFile(start_filename,diff_filename))
         {
@@ -301,7 +415,7 @@ int main(int argc, char* argv[])
             return 0;
         }
 
-        create(start_filename, diff_filename, end_filename);
+        create(start_filename, diff_filename, end_filename, threads, zstdFlag);
     }
     catch (const std::exception& e)
     {
@@ -27,10 +27,26 @@
 #include <list>
 #include <algorithm>
 #include <sstream>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <limits>
+
+#include <getopt.h>
 
 #include "tools.h"
 #include "version.h"
 
+struct RecreateOptions
+{
+  unsigned int threads = 4;
+  zim::size_type clusterSize = 2048;
+  zim::CompressionType compression = zim::zimcompLzma;
+  std::string language;  // Empty to use the language of the origin.
+  bool withIndex = true;
+  bool verbose = true;
+};
+
 /**
  * A PatchItem. This patch html and css content to remove the namespcae from the links.
  */
@@ -71,36 +87,38 @@ class PatchItem : public zim::writer::Item
             return std::unique_ptr<zim::writer::ContentProvider>(new ItemProvider(item));
         }
 
-        std::string content = item.getData();
-        // This is a really poor url rewriting to remove the starting "../<NS>/"
-        // and replace the "../../<NS/" by "../" :
-        // - Performance may be better
-        // - We only fix links in articles in "root" path (`foo.html`) and in one subdirectory (`bar/foo.hmtl`)
-        //   Deeper articles are not fixed (`bar/baz/foo.html`).
-        // - We may change content starting by `'../A/` even if they are not links
-        // - We don't handle links where we go upper in the middle of the link : `../foo/../I/image.png`
-        // - ...
-        // However, this should patch most of the links in our zim files.
-        for (std::string prefix: {"'", "\""}) {
-          for (auto ns : {'A','I','J','-'}) {
-            replaceStringInPlace(content, prefix+"../../"+ns+"/", prefix+"../");
-            replaceStringInPlace(content, prefix+"../"+ns+"/", prefix);
-          }
-        }
+        // Remove the namespace from the links ("../A/foo.html" -> "foo.html",
+        // "../../I/bar.png" -> "../bar.png").
+        // We may change content starting by `'../A/` even if they are not links.
+        auto content = removeLinksNamespace(item.getData());
         return std::unique_ptr<zim::writer::ContentProvider>(new zim::writer::StringProvider(content));
     }
 };
 
 
-void create(const std::string& originFilename, const std::string& outFilename, bool zstdFlag)
+// The language of the origin ("Language" metadata), to index the content.
+std::string getLanguage(const zim::Archive& origin)
+{
+  auto keys = origin.getMetadataKeys();
+  if (std::find(keys.begin(), keys.end(), "Language") == keys.end()) {
+    return "eng";
+  }
+  // The metadata may contain several languages ("eng,fra"). Use the first one.
+  auto language = origin.getMetadata("Language");
+  language = language.substr(0, language.find(','));
+  return language.empty() ? "eng" : language;
+}
+
+void create(const std::string& originFilename, const std::string& outFilename, const RecreateOptions& options)
 {
   zim::Archive origin(originFilename);
+  const auto language = options.language.empty() ? getLanguage(origin) : options.language;
   zim::writer::Creator zimCreator;
-  zimCreator.configVerbose(true)
-            // [TODO] Use the correct language
-            .configIndexing(true, "eng")
-            .configMinClusterSize(2048)
-            .configCompression(zstdFlag ? zim::zimcompZstd : zim::zimcompLzma);
+  zimCreator.configVerbose(options.verbose)
+            .configIndexing(options.withIndex, language)
+            .configMinClusterSize(options.clusterSize)
+            .configNbWorkers(options.threads)
+            .configCompression(options.compression);
 
   std::cout << "starting zim creation" << std::endl;
   zimCreator.startZimCreation(outFilename);
@@ -169,52 +187,118 @@ void usage()
     std::cout << "\nzimrecreate recreates a ZIM file from a existing ZIM.\n"
     "\nUsage: zimrecreate ORIGIN_FILE OUTPUT_FILE [Options]"
     "\nOptions:\n"
-    "\t-v, --version    print software version\n"
-    "\t-z, --zstd       use Zstandard as ZIM compression (lzma otherwise)\n";
+    "\t-v, --version             print software version\n"
+    "\t-J, --threads=N           count of threads to utilize (default: 4)\n"
+    "\t-m, --cluster-size=N      number of bytes per ZIM cluster (default: 2048)\n"
+    "\t-c, --compression=METHOD  compression of the clusters: lzma (default), zstd or none\n"
+    "\t-z, --zstd                same as --compression=zstd\n"
+    "\t-l, --lang=LANG           language used to index the content\n"
+    "\t                          (default: the Language metadata of ORIGIN_FILE)\n"
+    "\t-j, --no-index            don't create a fulltext index of the content\n"
+    "\t-q, --quiet               don't print the progress of the creation\n";
     return;
 }
 
+// Parse a number greater than 0 and at most `max`.
+// Return false if `arg` is not such a number.
+bool parsePositive(const char* arg, unsigned long long max, unsigned long long& value)
+{
+    char* end;
+    errno = 0;
+    const long long number = strtoll(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || number < 1
+     || static_cast<unsigned long long>(number) > max) {
+        return false;
+    }
+    value = number;
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
-    bool zstdFlag = false;
+    static struct option long_options[]
+        = {{"help", no_argument, 0, 'h'},
+           {"version", no_argument, 0, 'v'},
+           {"threads", required_argument, 0, 'J'},
+           {"cluster-size", required_argument, 0, 'm'},
+           {"compression", required_argument, 0, 'c'},
+           {"zstd", no_argument, 0, 'z'},
+           {"lang", required_argument, 0, 'l'},
+           {"no-index", no_argument, 0, 'j'},
+           {"quiet", no_argument, 0, 'q'},
+           {0, 0, 0, 0}};
+    RecreateOptions options;
+    unsigned long long number;
+    int option_index = 0;
+    int c;
 
-    //Parsing arguments
-    //There will be only two arguments, so no detailed parsing is required.
     std::cout<<"zimrecreate\n";
-    for(int i=0;i<argc;i++)
+    while ((c = getopt_long(argc, argv, "hHvJ:m:c:zl:jq", long_options, &option_index)) != -1)
     {
-        if(std::string(argv[i])=="-H" ||
-           std::string(argv[i])=="--help" ||
-           std::string(argv[i])=="-h")
-        {
-            usage();
-            return 0;
-        }
-
-        if(std::string(argv[i])=="--version" ||
-           std::string(argv[i])=="-v")
-        {
-            version();
-            return 0;
-        }
-
-        if(std::string(argv[i])=="--zstd" ||
-           std::string(argv[i])=="-z")
+        switch (c)
         {
-            zstdFlag = true;
+            case 'h':
+            case 'H':
+                usage();
+                return 0;
+            case 'v':
+                version();
+                return 0;
+            case 'J':
+                if (!parsePositive(optarg, UINT_MAX, number)) {
+                    std::cout<<"\n[ERROR] The number of threads must be greater than 0\n";
+                    return -1;
+                }
+                options.threads = number;
+                break;
+            case 'm':
+                if (!parsePositive(optarg, std::numeric_limits<zim::size_type>::max(), number)) {
+                    std::cout<<"\n[ERROR] The cluster size must be greater than 0\n";
+                    return -1;
+                }
+                options.clusterSize = number;
+                break;
+            case 'c':
+                if (std::string(optarg) == "lzma") {
+                    options.compression = zim::zimcompLzma;
+                } else if (std::string(optarg) == "zstd") {
+                    options.compression = zim::zimcompZstd;
+                } else if (std::string(optarg) == "none") {
+                    options.compression = zim::zimcompNone;
+                } else {
+                    std::cout<<"\n[ERROR] Unknown compression method "<<optarg<<"\n";
+                    usage();
+                    return -1;
+                }
+                break;
+            case 'z':
+                options.compression = zim::zimcompZstd;
+                break;
+            case 'l':
+                options.language = optarg;
+                break;
+            case 'j':
+                options.withIndex = false;
+                break;
+            case 'q':
+                options.verbose = false;
+                break;
+            default:
+                usage();
+                return -1;
         }
     }
-    if(argc<3)
+    if(argc-optind<2)
     {
         std::cout<<"\n[ERROR] Not enough Arguments provided\n";
         usage();
         return -1;
     }
-    std::string originFilename =argv[1];
-    std::string outputFilename =argv[2];
+    std::string originFilename =argv[optind];
+    std::string outputFilename =argv[optind+1];
     try
     {
-        create(originFilename, outputFilename, zstdFlag);
+        create(originFilename, outputFilename, options);
     }
     catch (const std::exception& e)
     {
@@ -18,57 +18,329 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+
+#include <stdlib.h>
+#include <getopt.h>
+
 #include <zim/search.h>
 #include <zim/archive.h>
 
 #include "version.h"
 
-void printSearchResults(zim::Search& search)
+struct SearchOptions
+{
+  // Without a page (--limit or --offset), all the results are returned.
+  bool paging = false;
+  int offset = 0;
+  int limit = 0;  // 0 for no limit.
+  bool estimate = false;
+  bool paths = false;
+  bool snippets = false;
+};
+
+// Only the results of the page [offset, offset+limit) are fetched, so the
+// paths and snippets are only computed for them.
+void printSearchResults(zim::Search& search, const SearchOptions& options, std::ostream& out)
+{
+    if (options.paging) {
+      const int end = options.limit > 0 && options.limit <= std::numeric_limits<int>::max() - options.offset
+                    ? options.offset + options.limit
+                    : std::numeric_limits<int>::max();
+      search.set_range(options.offset, end);
+    }
+    auto it = search.begin();
+    if (options.estimate) {
+      out << "estimated matches: " << search.get_matches_estimated() << std::endl;
+    }
+    for (; it != search.end(); ++it)
+    {
+      out << "article " << it->getIndex() << "\nscore " << it.get_score() << "\t:\t" << it->getTitle() << std::endl;
+      if (options.paths) {
+        out << "path " << it.get_url() << std::endl;
+      }
+      if (options.snippets) {
+        out << "snippet " << it.get_snippet() << std::endl;
+      }
+    }
+}
+
+// Run queries on a pool of threads sharing the archive.
+// The results are written in the order of the queries: the results of a
+// query are written as soon as it and all the previous queries are done.
+class QueryRunner
 {
-    for (zim::Search::iterator it = search.begin(); it != search.end(); ++it)
+  public:
+    QueryRunner(const zim::Archive& archive, const SearchOptions& options,
+                unsigned nbThreads, std::ostream& out)
+      : archive(archive),
+        options(options),
+        out(out),
+        nextQuery(0),
+        nextOutput(0),
+        finished(false)
+    {
+      for (unsigned t = 0; t < nbThreads; t++) {
+        workers.push_back(std::thread(&QueryRunner::work, this));
+      }
+    }
+
+    void push(const std::string& query)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      // Don't read the queries much faster than they are run.
+      queueNotFull.wait(lock, [&]() { return queue.size() < 2 * workers.size(); });
+      queue.push_back(std::make_pair(nextQuery++, query));
+      queueNotEmpty.notify_one();
+    }
+
+    // Wait for the end of the pushed queries.
+    void finish()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+      }
+      queueNotEmpty.notify_all();
+      for (auto& worker:workers) {
+        worker.join();
+      }
+      workers.clear();
+    }
+
+    // Latency of each query, in seconds.
+    const std::vector<double>& getLatencies() const { return latencies; }
+
+  private:
+    void work()
     {
-      std::cout << "article " << it->getIndex() << "\nscore " << it.get_score() << "\t:\t" << it->getTitle() << std::endl;
+      while (true) {
+        std::pair<size_t, std::string> query;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          queueNotEmpty.wait(lock, [&]() { return finished || !queue.empty(); });
+          if (queue.empty()) {
+            return;
+          }
+          query = queue.front();
+          queue.pop_front();
+          queueNotFull.notify_one();
+        }
+
+        std::ostringstream result;
+        result << "query: " << query.second << std::endl;
+        auto start = std::chrono::steady_clock::now();
+        try {
+          zim::Search search(archive);
+          search.set_query(query.second);
+          printSearchResults(search, options, result);
+        } catch (const std::exception& e) {
+          result << "error: " << e.what() << std::endl;
+        }
+        auto end = std::chrono::steady_clock::now();
+        result << std::endl;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        latencies.push_back(std::chrono::duration<double>(end - start).count());
+        done[query.first] = result.str();
+        for (auto it = done.find(nextOutput); it != done.end(); it = done.find(++nextOutput)) {
+          out << it->second << std::flush;
+          done.erase(it);
+        }
+      }
     }
+
+    const zim::Archive& archive;
+    const SearchOptions options;
+    std::ostream& out;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable queueNotEmpty;
+    std::condition_variable queueNotFull;
+    std::deque<std::pair<size_t, std::string>> queue;
+    std::map<size_t, std::string> done;
+    std::vector<double> latencies;
+    size_t nextQuery;
+    size_t nextOutput;
+    bool finished;
+};
+
+void printStats(std::vector<double> latencies, double seconds)
+{
+  if (latencies.empty()) {
+    return;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto ms = [&](double p) { return latencies[size_t(p * (latencies.size() - 1))] * 1000; };
+  double sum = 0;
+  for (auto latency:latencies) {
+    sum += latency;
+  }
+  std::cerr << latencies.size() << " queries in " << seconds << "s: "
+            << latencies.size() / seconds << " queries/s\n"
+            << "latency (ms): mean=" << sum / latencies.size() * 1000
+            << " p50=" << ms(0.5) << " p90=" << ms(0.9) << " p99=" << ms(0.99)
+            << " max=" << ms(1) << std::endl;
+}
+
+void usage(const char* name)
+{
+  std::cerr << "\nzimsearch allows to search content in a ZIM file.\n\n"
+    "usage: " << name << " [options] zimfile searchstring\n"
+    "       " << name << " [options] --queries=file zimfile\n"
+    "       " << name << " [options] --stdin zimfile\n"
+    "\n"
+    "options\n"
+    "  -q, --queries=file  run the queries of file, one per line\n"
+    "  -s, --stdin         run the queries read on the standard input, one per line,\n"
+    "                      until its end\n"
+    "  -J, --threads=N     number of queries run at the same time (default: 4)\n"
+    "  -l, --limit=N       number of results to return per query (default: all)\n"
+    "  -o, --offset=N      index of the first result to return (default: 0)\n"
+    "  -e, --estimate      print the estimated number of matches before the results\n"
+    "                      (implied by --limit and --offset)\n"
+    "  -p, --paths         print the path of the results\n"
+    "  -S, --snippets      print a snippet of the results\n"
+    "  -v                  print software version\n"
+    "\n"
+    "With --queries and --stdin, the results of each query start by a line\n"
+    "\"query: <query>\" and end by an empty line. They are written in the order\n"
+    "of the queries. The number of queries per second and their latency are\n"
+    "written on the standard error at the end.\n" << std::endl;
 }
 
 int main(int argc, char* argv[])
 {
+  static struct option long_options[]
+    = {{"help", no_argument, 0, 'h'},
+       {"version", no_argument, 0, 'v'},
+       {"queries", required_argument, 0, 'q'},
+       {"stdin", no_argument, 0, 's'},
+       {"threads", required_argument, 0, 'J'},
+       {"limit", required_argument, 0, 'l'},
+       {"offset", required_argument, 0, 'o'},
+       {"estimate", no_argument, 0, 'e'},
+       {"paths", no_argument, 0, 'p'},
+       {"snippets", no_argument, 0, 'S'},
+       {0, 0, 0, 0}};
+  std::string queryFile;
+  bool fromStdin = false;
+  unsigned threads = 4;
+  SearchOptions options;
+
   try
   {
-
-    // version number
-    if (argc > 1 && std::string(argv[1]) == "-v")
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "hvq:sJ:l:o:epS", long_options, &option_index)) != -1)
     {
-      version();
-      return 0;
+      switch (c)
+      {
+        case 'v':
+          version();
+          return 0;
+        case 'q':
+          queryFile = optarg;
+          break;
+        case 's':
+          fromStdin = true;
+          break;
+        case 'J':
+          threads = std::max(1, atoi(optarg));
+          break;
+        case 'l':
+          options.limit = atoi(optarg);
+          options.paging = options.estimate = true;
+          if (options.limit < 1) {
+            std::cerr << "The limit must be greater than 0" << std::endl;
+            return 1;
+          }
+          break;
+        case 'o':
+          options.offset = atoi(optarg);
+          options.paging = options.estimate = true;
+          if (options.offset < 0) {
+            std::cerr << "The offset must be positive" << std::endl;
+            return 1;
+          }
+          break;
+        case 'e':
+          options.estimate = true;
+          break;
+        case 'p':
+          options.paths = true;
+          break;
+        case 'S':
+          options.snippets = true;
+          break;
+        default:
+          usage(argv[0]);
+          return 1;
+      }
     }
 
-    if (argc <= 2)
+    const bool batch = fromStdin || !queryFile.empty();
+    if (argc - optind < (batch ? 1 : 2))
     {
-      std::cerr << "\nzimsearch allows to search content in a ZIM file.\n\n"
-        "usage: " << argv[0] << " [-x indexfile] zimfile searchstring\n"
-        "\n"
-        "options\n"
-        "  -x indexfile   specify indexfile\n"
-        "  -v             print software version\n" << std::endl;
+      usage(argv[0]);
       return 1;
     }
 
-    std::string s = argv[2];
-    for (int a = 3; a < argc; ++a)
+    zim::Archive zimarchive(argv[optind]);
+
+    if (!batch)
     {
-      s += ' ';
-      s += argv[a];
+      std::string s = argv[optind + 1];
+      for (int a = optind + 2; a < argc; ++a)
+      {
+        s += ' ';
+        s += argv[a];
+      }
+
+      zim::Search search(zimarchive);
+      search.set_query(s);
+      printSearchResults(search, options, std::cout);
+      return 0;
     }
 
-    zim::Archive zimarchive(argv[1]);
-    zim::Search search(zimarchive);
-    search.set_query(s);
-    printSearchResults(search);
+    std::ifstream file;
+    if (!queryFile.empty()) {
+      file.open(queryFile);
+      if (!file) {
+        std::cerr << "Impossible to open " << queryFile << std::endl;
+        return 1;
+      }
+    }
+    std::istream& in = queryFile.empty() ? std::cin : file;
+
+    auto start = std::chrono::steady_clock::now();
+    QueryRunner runner(zimarchive, options, threads, std::cout);
+    for (std::string query; std::getline(in, query);)
+    {
+      if (!query.empty() && query.back() == '\r') {
+        query.pop_back();
+      }
+      if (!query.empty()) {
+        runner.push(query);
+      }
+    }
+    runner.finish();
+    auto end = std::chrono::steady_clock::now();
+    printStats(runner.getLatencies(), std::chrono::duration<double>(end - start).count());
   }
   catch (const std::exception& e)
   {
     std::cerr << e.what() << std::endl;
   }
 }
-
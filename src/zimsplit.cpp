@@ -17,96 +17,222 @@
  * MA 02110-1301, USA.
  */
 
-#include <fstream>
+#include <iostream>
 #include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <functional>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <unistd.h>
+# include <sys/mman.h>
+#endif
 
 #define ZIM_PRIVATE
 #include <zim/archive.h>
 
 #include <docopt/docopt.h>
 
+#include "tools.h"
 #include "version.h"
 
-#define BUFFER_SIZE 4096
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+// Maximum length asked to copy_file_range in one call.
+#define COPY_EXTENT_SIZE (1024*1024*1024)
+// Size of the input window mapped at once when copying through mmap.
+#define MMAP_WINDOW_SIZE (64*1024*1024)
+// Buffer size when we have to copy with read/write.
+#define BUFFER_SIZE (1024*1024)
 
 #define DEFAULT_PART_SIZE 2147483648
 
+// A range of the zim file to write in one part.
+struct Part
+{
+    std::string name;
+    zim::offset_type offset;
+    zim::offset_type size;
+    std::string md5;
+};
+
 class ZimSplitter
 {
   private:
     zim::Archive archive;
+    const std::string fname;
     const std::string prefix;
-    zim::size_type partSize;
-
-    char first_index, second_index;
+    zim::offset_type partSize;
+    bool balanced;
 
-    std::ifstream ifile;
-    std::ofstream ofile;
-    std::string part_name;
-    zim::size_type out_size;
-    char* batch_buffer;
+    int ifd;
+    std::atomic<bool> use_copy_file_range;
 
   public:
-    ZimSplitter(const std::string& fname, const std::string& out_prefix, zim::size_type partSize)
+    ZimSplitter(const std::string& fname, const std::string& out_prefix, zim::offset_type partSize, bool balanced)
       : archive(fname),
+        fname(fname),
         prefix(out_prefix),
         partSize(partSize),
-        first_index(0),
-        second_index(0),
-        ifile(fname, std::ios::binary),
-        out_size(0)
+        balanced(balanced),
+        ifd(open(fname.c_str(), O_RDONLY | O_BINARY)),
+        use_copy_file_range(true)
       {
-        batch_buffer = new char[BUFFER_SIZE];
+        if (ifd == -1) {
+            throw std::runtime_error(std::string("Cannot open zim file ") + fname + ": " + strerror(errno));
+        }
     }
 
     ~ZimSplitter() {
-        close_file();
-        ifile.close();
-        delete batch_buffer;
+        close(ifd);
     }
 
-    std::string get_new_suffix() {
-        auto out = std::string(1, 'a'+first_index) + std::string(1, 'a'+second_index++);
-        if (second_index > 25) {
-            first_index++;
-            second_index = 0;
-        }
-        if (first_index > 25) {
+    static std::string get_suffix(size_t index) {
+        if (index >= 26*26) {
             std::cerr << "To many parts" << std::endl;
             exit(-1);
         }
-        return out;
+        return std::string(1, 'a'+index/26) + std::string(1, 'a'+index%26);
     }
 
-    void close_file() {
-        if (out_size > partSize) {
-           std::cout << "WARNING: Part " << part_name << " is bigger that max part size."
-            << " (" << out_size << ">" << partSize << ")" << std::endl;
+    static void write_out(int ofd, const char* data, size_t size, Md5Hasher* hasher) {
+        if (hasher) {
+            hasher->update(data, size);
+        }
+        while (size > 0) {
+            auto written = write(ofd, data, size);
+            if (written <= 0) {
+                if (written == -1 && errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Error while writing zim part");
+            }
+            data += written;
+            size -= written;
         }
-        ofile.close();
     }
 
-    void new_file() {
-        close_file();
-        part_name = prefix + get_new_suffix();
-        std::cout << "opening new file " << part_name << std::endl;
-        ofile.open(part_name, std::ios::binary);
-        out_size = 0;
+#ifdef HAVE_COPY_FILE_RANGE
+    // Let the kernel copy the data (and share the extents on filesystems
+    // supporting reflinks). Returns the size which has been copied, less than
+    // `size` if copy_file_range cannot be used for those files.
+    zim::offset_type copy_with_copy_file_range(int ofd, zim::offset_type offset, zim::offset_type size) {
+        zim::offset_type copied = 0;
+        while (use_copy_file_range && copied < size) {
+            loff_t off_in = offset + copied;
+            auto len = std::min<zim::offset_type>(size - copied, COPY_EXTENT_SIZE);
+            auto ret = copy_file_range(ifd, &off_in, ofd, nullptr, len, 0);
+            if (ret > 0) {
+                copied += ret;
+                continue;
+            }
+            if (ret == 0) {
+                throw std::runtime_error("Error while reading zim file");
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EXDEV || errno == ENOSYS || errno == EINVAL
+             || errno == EOPNOTSUPP || errno == EBADF) {
+                // Not supported between those files, fallback on user space copy.
+                use_copy_file_range = false;
+                break;
+            }
+            throw std::runtime_error(std::string("Error while copying zim part: ") + strerror(errno));
+        }
+        return copied;
     }
+#endif
 
-    void copy_out(zim::size_type size) {
+#ifndef _WIN32
+    void copy_with_mmap(int ofd, zim::offset_type offset, zim::offset_type size, Md5Hasher* hasher) {
+        static const zim::offset_type page_size = sysconf(_SC_PAGESIZE);
         while (size > 0) {
-           auto size_to_copy = std::min<zim::size_type>(size, BUFFER_SIZE);
-           ifile.read(batch_buffer, size_to_copy);
-           if (!ifile) {
-               throw std::runtime_error("Error while reading zim file");
-           }
-           ofile.write(batch_buffer, size_to_copy);
-           if (!ofile) {
-               throw std::runtime_error("Error while writing zim part");
-           }
-           out_size += size_to_copy;
-           size -= size_to_copy;
+            const auto map_start = offset - (offset % page_size);
+            const auto skip = offset - map_start;
+            const auto len = std::min<zim::offset_type>(size, MMAP_WINDOW_SIZE);
+            auto map = mmap(nullptr, skip+len, PROT_READ, MAP_PRIVATE, ifd, map_start);
+            if (map == MAP_FAILED) {
+                throw std::runtime_error(std::string("Error while reading zim file: ") + strerror(errno));
+            }
+            madvise(map, skip+len, MADV_SEQUENTIAL);
+            try {
+                write_out(ofd, static_cast<const char*>(map) + skip, len, hasher);
+            } catch (...) {
+                munmap(map, skip+len);
+                throw;
+            }
+            munmap(map, skip+len);
+            offset += len;
+            size -= len;
+        }
+    }
+#else
+    void copy_with_mmap(int ofd, zim::offset_type offset, zim::offset_type size, Md5Hasher* hasher) {
+        // The file position is shared, so each part reads through its own descriptor.
+        int fd = open(fname.c_str(), O_RDONLY | O_BINARY);
+        if (fd == -1 || _lseeki64(fd, offset, SEEK_SET) == -1) {
+            throw std::runtime_error("Error while reading zim file");
+        }
+        std::vector<char> buffer(BUFFER_SIZE);
+        while (size > 0) {
+            auto size_to_copy = std::min<zim::offset_type>(size, BUFFER_SIZE);
+            if (read(fd, buffer.data(), size_to_copy) != int(size_to_copy)) {
+                close(fd);
+                throw std::runtime_error("Error while reading zim file");
+            }
+            write_out(ofd, buffer.data(), size_to_copy, hasher);
+            size -= size_to_copy;
+        }
+        close(fd);
+    }
+#endif
+
+    // Write one part. If `withChecksum`, the data goes through user space
+    // to be hashed while it is written.
+    void write_part(Part& part, bool withChecksum) {
+        // Build the line first, so lines of concurrent writers do not mix.
+        std::cout << ("writing part " + part.name + " (" + std::to_string(part.size) + " bytes)\n") << std::flush;
+        int ofd = open(part.name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+        if (ofd == -1) {
+            throw std::runtime_error(std::string("Cannot open zim part ") + part.name + ": " + strerror(errno));
+        }
+        try {
+            zim::offset_type copied = 0;
+#ifdef HAVE_COPY_FILE_RANGE
+            if (!withChecksum) {
+                copied = copy_with_copy_file_range(ofd, part.offset, part.size);
+            }
+#endif
+            Md5Hasher hasher;
+            if (copied < part.size) {
+                copy_with_mmap(ofd, part.offset + copied, part.size - copied, withChecksum ? &hasher : nullptr);
+            }
+            if (withChecksum) {
+                part.md5 = hasher.hexDigest();
+            }
+        } catch (...) {
+            close(ofd);
+            throw;
+        }
+        if (close(ofd) != 0) {
+            throw std::runtime_error(std::string("Error while writing zim part ") + part.name);
         }
     }
 
@@ -121,36 +247,225 @@ class ZimSplitter
         return offsets;
     }
 
-    void run() {
-        new_file();
-
-        auto offsets = getOffsets();
+    // Fill the parts greedily: start a new part when the next cluster doesn't fit.
+    std::vector<Part> plan_greedy(const std::vector<zim::offset_type>& offsets) {
+        std::vector<Part> parts;
 
+        Part current = {"", 0, 0, ""};
         zim::offset_type last(0);
         for(auto offset:offsets) {
             auto currentSize = offset-last;
             if (currentSize > partSize) {
                 // One part is bigger than what we want :/
                 // Still have to write it.
-                if (out_size) {
-                    new_file();
+                if (current.size) {
+                    parts.push_back(current);
                 }
-                copy_out(currentSize);
-                new_file();
+                current = {"", last, currentSize, ""};
+                parts.push_back(current);
+                current = {"", offset, 0, ""};
             } else {
-                if (out_size+currentSize > partSize) {
+                if (current.size+currentSize > partSize) {
                     // It would be too much to write the current part in the current file.
-                    new_file();
+                    parts.push_back(current);
+                    current = {"", last, 0, ""};
                 }
-                copy_out(currentSize);
+                current.size += currentSize;
             }
             last = offset;
         }
+        if (current.size) {
+            parts.push_back(current);
+        }
+        return parts;
+    }
+
+    // Split the run of clusters between `bounds[first]` and `bounds[last]`
+    // (none of them bigger than partSize) in the minimum number of parts,
+    // choosing the boundaries which minimize the variance of the part sizes.
+    //
+    // The minimum count K is given by the greedy fill. With K fixed, minimizing
+    // the variance is minimizing the sum of the squares of the part sizes.
+    // dp[k][i] is the minimal sum for the first i clusters cut in k parts. The
+    // cost of a part is a convex function of its size (infinite over partSize),
+    // so the best previous boundary is monotone in i and each layer is solved
+    // by divide and conquer in O(w.log(w)), w being the number of possible
+    // positions of the boundary.
+    void plan_run(const std::vector<zim::offset_type>& bounds, size_t first, size_t last,
+                  std::vector<Part>& parts) {
+        const size_t n = last - first;
+        auto sizeOf = [&](size_t from, size_t to) { return bounds[first+to] - bounds[first+from]; };
+
+        // Furthest boundary reachable with k parts from the start.
+        std::vector<size_t> hi(1, 0);
+        while (hi.back() < n) {
+            size_t i = hi.back();
+            while (i < n && sizeOf(hi.back(), i+1) <= partSize) {
+                i++;
+            }
+            hi.push_back(i);
+        }
+        const size_t K = hi.size() - 1;
+
+        // Nearest boundary from which the end can be reached with K-k parts.
+        std::vector<size_t> lo(K+1, 0);
+        lo[K] = n;
+        for (size_t k = K; k > 1; --k) {
+            size_t i = lo[k];
+            while (i > 0 && sizeOf(i-1, lo[k]) <= partSize) {
+                i--;
+            }
+            lo[k-1] = i;
+        }
+
+        auto windowStart = [&](size_t k) { return std::max(lo[k], k); };
+        const double inf = std::numeric_limits<double>::infinity();
+        std::vector<std::vector<double>> dp(K+1);
+        std::vector<std::vector<size_t>> choice(K+1);
+        dp[0].assign(1, 0.);
+        choice[0].assign(1, 0);
+        for (size_t k = 1; k <= K; ++k) {
+            const size_t start = windowStart(k);
+            const size_t prevStart = windowStart(k-1);
+            const size_t prevEnd = k == 1 ? 0 : hi[k-1];
+            dp[k].assign(hi[k] - start + 1, inf);
+            choice[k].assign(hi[k] - start + 1, prevStart);
+
+            std::function<void(size_t, size_t, size_t, size_t)> solve =
+              [&](size_t l, size_t r, size_t optl, size_t optr) {
+                if (l > r) {
+                    return;
+                }
+                const size_t mid = l + (r-l)/2;
+                size_t best = optr;
+                for (size_t j = optl; j <= std::min(optr, mid-1); ++j) {
+                    const auto size = sizeOf(j, mid);
+                    if (size > partSize) {
+                        continue;
+                    }
+                    const double cost = dp[k-1][j-prevStart] + double(size)*double(size);
+                    if (cost < dp[k][mid-start]) {
+                        dp[k][mid-start] = cost;
+                        best = j;
+                    }
+                }
+                choice[k][mid-start] = best;
+                if (mid > l) {
+                    solve(l, mid-1, optl, best);
+                }
+                solve(mid+1, r, best, optr);
+            };
+            solve(start, hi[k], prevStart, prevEnd);
+        }
+
+        std::vector<size_t> cuts(K+1);
+        cuts[K] = n;
+        for (size_t k = K; k > 0; --k) {
+            cuts[k-1] = choice[k][cuts[k]-windowStart(k)];
+        }
+        for (size_t k = 0; k < K; ++k) {
+            Part part = {"", bounds[first+cuts[k]], sizeOf(cuts[k], cuts[k+1]), ""};
+            parts.push_back(part);
+        }
+    }
+
+    // Minimize the number of parts and the variance of their sizes.
+    // Clusters bigger than partSize are still alone in their parts.
+    std::vector<Part> plan_balanced(const std::vector<zim::offset_type>& offsets) {
+        std::vector<Part> parts;
+        std::vector<zim::offset_type> bounds(1, 0);
+        bounds.insert(bounds.end(), offsets.begin(), offsets.end());
+
+        size_t runStart = 0;
+        for (size_t i = 1; i < bounds.size(); ++i) {
+            auto currentSize = bounds[i] - bounds[i-1];
+            if (currentSize > partSize) {
+                if (i-1 > runStart) {
+                    plan_run(bounds, runStart, i-1, parts);
+                }
+                Part part = {"", bounds[i-1], currentSize, ""};
+                parts.push_back(part);
+                runStart = i;
+            }
+        }
+        if (bounds.size()-1 > runStart) {
+            plan_run(bounds, runStart, bounds.size()-1, parts);
+        }
+        return parts;
+    }
+
+    // Compute the ranges of all the parts.
+    std::vector<Part> plan() {
+        auto offsets = getOffsets();
+        auto parts = balanced ? plan_balanced(offsets) : plan_greedy(offsets);
+        for (size_t i = 0; i < parts.size(); ++i) {
+            parts[i].name = prefix + get_suffix(i);
+        }
+        return parts;
     }
 
-    bool check() {
+    void run(unsigned int nbWriters, const std::string& manifest) {
+        auto parts = plan();
+        const bool withChecksum = !manifest.empty();
+        for (auto& part:parts) {
+            if (part.size > partSize) {
+                std::cout << "WARNING: Part " << part.name << " is bigger that max part size."
+                 << " (" << part.size << ">" << partSize << ")" << std::endl;
+            }
+        }
+
+        // Parts are independent, each writer takes the next part to write.
+        std::atomic<size_t> next(0);
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        std::vector<std::thread> writers;
+        nbWriters = std::max(1U, std::min<unsigned int>(nbWriters, parts.size()));
+        for (unsigned int i = 0; i < nbWriters; ++i) {
+            writers.push_back(std::thread([&]() {
+                size_t index;
+                while ((index = next++) < parts.size()) {
+                    try {
+                        write_part(parts[index], withChecksum);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(errorMutex);
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                        next = parts.size();
+                    }
+                }
+            }));
+        }
+        for (auto& writer:writers) {
+            writer.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        if (withChecksum) {
+            std::ofstream out(manifest);
+            for (auto& part:parts) {
+                out << part.name << '\t' << part.size << '\t' << part.md5 << '\n';
+            }
+            if (!out) {
+                throw std::runtime_error("Error while writing manifest " + manifest);
+            }
+        }
+    }
+
+    bool check(bool showPlan) {
         bool error = false;
 
+        if (showPlan) {
+            auto parts = plan();
+            std::cout << "The zim file would be split in " << parts.size() << " parts"
+                      << (balanced ? " (balanced):" : ":") << std::endl;
+            for (auto& part:parts) {
+                std::cout << "    " << part.name << "\t" << part.offset << "\t" << part.size << std::endl;
+            }
+        }
+
         auto offsets = getOffsets();
 
         zim::offset_type last(0);
@@ -173,13 +488,19 @@ static const char USAGE[] = R"(
     zimsplit splits smartly a ZIM file in smaller parts.
 
 Usage:
-    zimsplit [--prefix=PREFIX] [--force] [--size=N] <file>
+    zimsplit [--prefix=PREFIX] [--force] [--size=N] [--balanced] [--dry-run] [--writers=N] [--manifest=FILE] <file>
     zimsplit --version
 
 Options:
     --prefix=PREFIX     Prefix of output file parts. Default: <file>
     --size=N            The file size for each part. Default: 2GB
     --force             Create zim parts even if it is impossible to have all part size smaller than requested
+    --balanced          Use the minimum number of parts with sizes as equal as possible,
+                        instead of filling each part as much as possible.
+    --dry-run           Only print the parts which would be created.
+    --writers=N         Number of parts written concurrently. Default: 1
+    --manifest=FILE     Write the name, size and md5 of each part in FILE (tab separated).
+                        The data is then hashed while copied instead of being copied by the kernel.
     -h, --help          Show this help message
     --version           Show zimsplit version.
 )";
@@ -199,20 +520,32 @@ int main(int argc, char* argv[])
     if (args["--prefix"])
         prefix = args["--prefix"].asString();
 
-    zim::size_type size = DEFAULT_PART_SIZE;
+    zim::offset_type size = DEFAULT_PART_SIZE;
     if (args["--size"])
         size = args["--size"].asLong();
 
     // initalize app
-    ZimSplitter app(args["<file>"].asString(), prefix, size);
+    ZimSplitter app(args["<file>"].asString(), prefix, size, args["--balanced"].asBool());
+
+    if (args["--dry-run"].asBool()) {
+        return app.check(true) ? -1 : 0;
+    }
 
-    if (!args["--force"] && app.check()) {
+    if (!args["--force"] && app.check(false)) {
         std::cout << "Creation of zim parts canceled because of previous errors." << std::endl;
         std::cout << "Use --force option to create zim parts anyway." << std::endl;
         return -1;
     }
 
-    app.run();
+    unsigned int nbWriters = 1;
+    if (args["--writers"])
+        nbWriters = args["--writers"].asLong();
+
+    std::string manifest;
+    if (args["--manifest"])
+        manifest = args["--manifest"].asString();
+
+    app.run(nbWriters, manifest);
   }
   catch (const std::exception& e)
   {
@@ -20,6 +20,7 @@
 
 #include "zimcreatorfs.h"
 #include "../tools.h"
+#include "../trace.h"
 #include "tools.h"
 
 #include <fstream>
@@ -33,7 +34,8 @@
 bool isVerbose();
 
 ZimCreatorFS::ZimCreatorFS(std::string _directoryPath)
-  : directoryPath(_directoryPath)
+  : directoryPath(_directoryPath),
+    progress(1)
 {
   char buf[PATH_MAX];
 
@@ -152,6 +154,8 @@ void ZimCreatorFS::visitDirectory(const std::string& path)
 
 void ZimCreatorFS::addFile(const std::string& path)
 {
+  ZIM_TRACE_SCOPE("addFile");
+  progress.report();
   auto url = path.substr(directoryPath.size()+1);
   auto mimetype = getMimeTypeForFile(directoryPath, url);
   auto title = std::string{};
@@ -160,6 +164,7 @@ void ZimCreatorFS::addFile(const std::string& path)
   if ( mimetype.find("text/html") != std::string::npos
     || mimetype.find("text/css") != std::string::npos) {
     auto content = getFileContent(path);
+    ZIM_TRACE_COUNT("addFile/parsedBytes", content.size());
 
     if (mimetype.find("text/html") != std::string::npos) {
       auto redirectUrl = parseAndAdaptHtml(content, title, url);
@@ -222,6 +227,7 @@ void ZimCreatorFS::processSymlink(const std::string& curdir, const std::string&
 
 void ZimCreatorFS::finishZimCreation()
 {
+  progress.finish();
   for(auto& handler: itemHandlers) {
     Creator::addMetadata(handler->getName(), handler->getData());
   }
@@ -261,6 +267,7 @@ struct GumboOutputDestructor {
 
 std::string ZimCreatorFS::parseAndAdaptHtml(std::string& data, std::string& title, const std::string& url)
 {
+  ZIM_TRACE_SCOPE("parseAndAdaptHtml");
   GumboOutput* output = gumbo_parse(data.c_str());
   GumboOutputDestructor outputDestructor(output);
   GumboNode* root = output->root;
@@ -26,6 +26,8 @@
 
 #include <zim/writer/creator.h>
 
+#include "../progress.h"
+
 class IHandler
 {
  public:
@@ -55,6 +57,9 @@ class ZimCreatorFS : public zim::writer::Creator
   std::string parseAndAdaptHtml(std::string& data, std::string& title, const std::string& url);
   void adaptCss(std::string& data, const std::string& url);
 
+  // Print the number of files added while the directory is visited.
+  void setProgressReport(bool report) { progress.set_progress_report(report); }
+
   void addMetadata(const std::string& key, const std::string& content) {
     if ( !content.empty() ) {
       zim::writer::Creator::addMetadata(key, content);
@@ -65,6 +70,7 @@ class ZimCreatorFS : public zim::writer::Creator
   std::vector<IHandler*> itemHandlers;
   std::string directoryPath;  ///< html dir without trailing slash
   std::string canonical_basedir;
+  ProgressBar progress;
 };
 
 #endif  // OPENZIM_ZIMWRITERFS_ARTICLESOURCE_H
@@ -65,6 +65,7 @@ int threads = 4;
 int minChunkSize = 2048;
 
 bool verboseFlag = false;
+bool progressFlag = false;
 bool withoutFTIndex = false;
 bool zstdFlag = false;
 bool noUuid = false;
@@ -152,6 +153,8 @@ void usage()
   std::cout << "Optional arguments:" << std::endl;
   std::cout << "\t-v, --verbose\t\tprint processing details on STDOUT"
             << std::endl;
+  std::cout << "\t-P, --progress\t\tprint the number of files added while the directory is visited"
+            << std::endl;
   std::cout << "\t-h, --help\t\tprint this help" << std::endl;
   std::cout << "\t-V, --version\t\tprint the version number" << std::endl;
   std::cout
@@ -205,6 +208,7 @@ void parse_args(int argc, char** argv)
   static struct option long_options[]
       = {{"help", no_argument, 0, 'h'},
          {"verbose", no_argument, 0, 'v'},
+         {"progress", no_argument, 0, 'P'},
          {"version", no_argument, 0, 'V'},
          {"welcome", required_argument, 0, 'w'},
          {"minchunksize", required_argument, 0, 'm'},
@@ -236,7 +240,7 @@ void parse_args(int argc, char** argv)
 
   do {
     c = getopt_long(
-        argc, argv, "hVvijxuzw:m:f:t:d:c:l:p:r:e:n:J:UB", long_options, &option_index);
+        argc, argv, "hVvPijxuzw:m:f:t:d:c:l:p:r:e:n:J:UB", long_options, &option_index);
 
     if (c != -1) {
       switch (c) {
@@ -254,6 +258,9 @@ void parse_args(int argc, char** argv)
         case 'v':
           verboseFlag = true;
           break;
+        case 'P':
+          progressFlag = true;
+          break;
         case 'x':
           inflateHtmlFlag = true;
           break;
@@ -386,6 +393,7 @@ void create_zim()
   if ( noUuid ) {
     zimCreator.setUuid(zim::Uuid());
   }
+  zimCreator.setProgressReport(progressFlag);
   if (zimPath.size() >= (MAXPATHLEN-1)) {
     throw std::invalid_argument("Target .zim file path is too long");
   }
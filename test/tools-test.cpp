@@ -3,6 +3,9 @@
 #include "../src/tools.h"
 #include <magic.h>
 #include <unordered_map>
+#include <chrono>
+#include <functional>
+#include <iostream>
 
 magic_t magic;
 bool inflateHtmlFlag = false;
@@ -193,14 +196,320 @@ TEST(tools, normalize_link)
     ASSERT_EQ(normalize_link(".././a", "/b/c"), "/b/a");
     ASSERT_EQ(normalize_link("../a/b/aa#localanchor", "/b/c"), "/b/a/b/aa");
     ASSERT_EQ(normalize_link("../a/b/aa?localanchor", "/b/c"), "/b/a/b/aa");
+
+    // decoding
+    ASSERT_EQ(normalize_link("a%20b%2Fc", "A"), "A/a b/c");
+    ASSERT_EQ(normalize_link("a%", "A"), "A/a%");
+    ASSERT_EQ(normalize_link("a%2", "A"), "A/a%2");
+    ASSERT_EQ(normalize_link("a%zz", "A"), "A/a%zz");
+
+    // ".." only at the start of a path segment
+    ASSERT_EQ(normalize_link("a../b", "A"), "A/a../b");
+    ASSERT_EQ(normalize_link("a/../b", "A"), "A/b");
+    ASSERT_EQ(normalize_link("../b", "A"), "b");
+    ASSERT_EQ(normalize_link("b", ""), "/b");
+
+    // The buffer is reused.
+    std::string output = "something longer than the result";
+    const std::string base = "A/b";
+    ASSERT_TRUE(normalizeLink("../c", 4, base.data(), base.size(), output));
+    ASSERT_EQ(output, "A/c");
+    ASSERT_TRUE(normalizeLink("../../c", 7, base.data(), base.size(), output));
+    ASSERT_EQ(output, "c");
+    ASSERT_FALSE(normalizeLink("../../../c", 10, base.data(), base.size(), output));
+    ASSERT_FALSE(normalizeLink("../c", 4, "/", 1, output));
+}
+
+namespace
+{
+// Count the allocations of the test binary.
+size_t allocationCount = 0;
+}
+
+// Not inlined: gcc would warn about the free() of a pointer returned by new.
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+NOINLINE void* operator new(size_t size)
+{
+    allocationCount++;
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+NOINLINE void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+TEST(tools, normalizeLinkAllocations)
+{
+    // Not only a test: show the allocations and the time per link of the
+    // zimcheck internal links check.
+    const std::string base = "A/Some_article";
+    std::vector<std::string> links;
+    for (auto link: {"Other_article", "../I/m/Image.png", "./Foo%20bar#section", "../-/s/style.css?v=2",
+                     "Article_with_a_long_enough_name_to_not_fit_in_a_small_string", "/A/Absolute"}) {
+        links.push_back(link);
+    }
+    const size_t repeat = 100000;
+
+    auto measure = [&](const char* name, std::function<void (const std::string&)> check) {
+        const auto allocations = allocationCount;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < repeat; i++) {
+            for (const auto& link: links) {
+                check(link);
+            }
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double count = repeat * links.size();
+        std::cout << "  " << name << ": " << (allocationCount - allocations) / count << " allocations and "
+                  << elapsed.count() / count * 1e9 << " ns per link" << std::endl;
+        return (allocationCount - allocations) / count;
+    };
+
+    measure("isOutofBounds + normalize_link", [&](const std::string& link) {
+        if (!isOutofBounds(link, base)) {
+            normalize_link(link, base);
+        }
+    });
+    std::string output;
+    output.reserve(256);
+    const auto allocations = measure("normalizeLink", [&](const std::string& link) {
+        normalizeLink(link.data(), link.size(), base.data(), base.size(), output);
+    });
+    ASSERT_EQ(allocations, 0);
+
+    measure("decodeUrl", [&](const std::string& link) { decodeUrl(link); });
+    const auto decodeAllocations = measure("decodeUrl (buffer)", [&](const std::string& link) {
+        decodeUrl(link.data(), link.size(), output);
+    });
+    ASSERT_EQ(decodeAllocations, 0);
 }
 
 TEST(tools, addler32)
 {
-    ASSERT_EQ(adler32("sdfkhewruhwe8"), 640746832);
-    ASSERT_EQ(adler32("sdifjsdf"), 251593550);
-    ASSERT_EQ(adler32("q"), 7471218);
-    ASSERT_EQ(adler32(""), 1);
+    ASSERT_EQ(adler32("sdfkhewruhwe8"), 640746832u);
+    ASSERT_EQ(adler32("sdifjsdf"), 251593550u);
+    ASSERT_EQ(adler32("q"), 7471218u);
+    ASSERT_EQ(adler32(""), 1u);
+    // Bytes are unsigned.
+    ASSERT_EQ(adler32("\xff\x80"), 0x02800180u);
+
+    // Same result as the byte per byte definition, whatever the
+    // implementation, the size and the alignment.
+    auto reference = [](const std::string& data) {
+        uint32_t s1 = 1, s2 = 0;
+        for (unsigned char c: data) {
+            s1 = (s1 + c) % 65521;
+            s2 = (s2 + s1) % 65521;
+        }
+        return (s2 << 16) | s1;
+    };
+    std::string data(70000, '\xff');
+    for (size_t size: {31, 32, 33, 100, 5552, 5553, 70000}) {
+        ASSERT_EQ(adler32(data.data(), size), reference(data.substr(0, size))) << size;
+    }
+    uint32_t seed = 1;
+    for (auto& c: data) {
+        seed = seed * 1103515245 + 12345;
+        c = char(seed >> 24);
+    }
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t size: {0, 1, 63, 64, 65, 1000, 11104, 69990}) {
+            ASSERT_EQ(adler32(data.data() + offset, size), reference(data.substr(offset, size))) << size;
+        }
+    }
+}
+
+TEST(tools, contentHash)
+{
+    const std::string data = "The quick brown fox jumps over the lazy dog, again and again and again.";
+    // All the sizes go through a different path for small contents.
+    for (size_t size = 0; size <= data.size(); size++) {
+        const auto hash = contentHash64(data.data(), size);
+        ASSERT_EQ(hash, contentHash64(std::string(data, 0, size).data(), size));
+        if (size > 0) {
+            ASSERT_NE(hash, contentHash64(data.data(), size - 1)) << size;
+            ASSERT_NE(hash, contentHash64(data.data() + 1, size - 1)) << size;
+            ASSERT_NE(hash, contentHash64(data.data(), size, 1)) << size;
+        }
+    }
+
+    // A change of one bit anywhere changes the hash.
+    std::string page(1000, 'a');
+    const auto hash = contentHash128(page.data(), page.size());
+    ASSERT_EQ(hash, contentHash128(page.data(), page.size()));
+    for (size_t i = 0; i < page.size(); i += 37) {
+        page[i] ^= 1;
+        ASSERT_NE(hash, contentHash128(page.data(), page.size())) << i;
+        page[i] ^= 1;
+    }
+}
+
+// Not a test, disabled by default: show the speed of the hashes, to compare
+// them with the memory bandwidth. Run it with
+//   tools-test --gtest_also_run_disabled_tests --gtest_filter=*hashThroughput
+TEST(tools, DISABLED_hashThroughput)
+{
+    const std::string data(16 << 20, 'x');
+    auto measure = [&](const char* name, std::function<uint64_t ()> hash) {
+        const auto start = std::chrono::steady_clock::now();
+        uint64_t result = 0;
+        const int repeat = 8;
+        for (int i = 0; i < repeat; i++) {
+            result += hash();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "  " << name << ": " << repeat * data.size() / elapsed.count() / 1e9
+                  << " GB/s (" << result << ")" << std::endl;
+    };
+    measure("adler32", [&]() { return adler32(data.data(), data.size()); });
+    measure("contentHash64", [&]() { return contentHash64(data.data(), data.size()); });
+    measure("contentHash128", [&]() { return contentHash128(data.data(), data.size()).low; });
+    Md5Hasher md5;
+    measure("md5", [&]() { md5.update(data.data(), data.size()); return 0; });
+}
+
+TEST(tools, md5)
+{
+    auto md5 = [](const std::string& s) {
+        Md5Hasher hasher;
+        hasher.update(s.data(), s.size());
+        return hasher.hexDigest();
+    };
+    ASSERT_EQ(md5(""), "d41d8cd98f00b204e9800998ecf8427e");
+    ASSERT_EQ(md5("abc"), "900150983cd24fb0d6963f7d28e17f72");
+    ASSERT_EQ(md5("The quick brown fox jumps over the lazy dog"), "9e107d9d372bb6826bd81d3542a419d6");
+    ASSERT_EQ(md5(std::string(1000, 'a')), "cabe45dcc9ae5b66ba86600cca6b8ba8");
+
+    // Feeding the data by chunks gives the same hash.
+    const std::string data(200, 'x');
+    Md5Hasher hasher;
+    for (size_t i = 0; i < data.size(); i += 7) {
+        hasher.update(data.data() + i, std::min<size_t>(7, data.size() - i));
+    }
+    ASSERT_EQ(hasher.hexDigest(), md5(data));
+}
+
+TEST(tools, jsonString)
+{
+    ASSERT_EQ(jsonString(""), "\"\"");
+    ASSERT_EQ(jsonString("A/Main_Page"), "\"A/Main_Page\"");
+    ASSERT_EQ(jsonString("a \"b\" \\c"), "\"a \\\"b\\\" \\\\c\"");
+    ASSERT_EQ(jsonString("\t\n\r"), "\"\\t\\n\\r\"");
+    ASSERT_EQ(jsonString(std::string("\0\x1f", 2)), "\"\\u0000\\u001f\"");
+    ASSERT_EQ(jsonString("\xc3\xa9"), "\"\xc3\xa9\"");
+
+    // Appended to the output.
+    std::string output = "[";
+    jsonString("x", output);
+    ASSERT_EQ(output, "[\"x\"");
+}
+
+TEST(tools, delta)
+{
+    auto roundtrip = [](const std::string& source, const std::string& target) {
+        auto delta = computeDelta(source.data(), source.size(), target.data(), target.size());
+        EXPECT_EQ(applyDelta(source.data(), source.size(), delta.data(), delta.size()), target);
+        return delta.size();
+    };
+
+    roundtrip("", "");
+    roundtrip("", "some new content");
+    roundtrip("some old content", "");
+    roundtrip("short", "short");
+
+    std::string page;
+    for (int i = 0; i < 2000; ++i) {
+        page += "<p>Paragraph number " + std::to_string(i) + "</p>\n";
+    }
+    std::string edited = page;
+    edited.replace(20000, 9, "A one-word edit");
+    edited.insert(100, "Inserted at the start");
+    edited.erase(edited.size() - 500, 200);
+    ASSERT_LT(roundtrip(page, edited), 200U);
+    ASSERT_LT(roundtrip(page, page), 20U);
+
+    // A content without anything in common.
+    std::string other(page.rbegin(), page.rend());
+    ASSERT_LT(roundtrip(page, other), other.size() + 20);
+
+    std::string delta = computeDelta(page.data(), page.size(), edited.data(), edited.size());
+    ASSERT_THROW(applyDelta(page.data(), 100, delta.data(), delta.size()), std::runtime_error);
+    ASSERT_THROW(applyDelta(page.data(), page.size(), delta.data(), delta.size()/2), std::runtime_error);
+
+    // A target size which the delta can't produce is rejected before
+    // allocating it.
+    const std::string hugeDelta("\xff\xff\xff\xff\xff\xff\xff\xff\x7f\x01\x01x", 12);
+    ASSERT_THROW(applyDelta(page.data(), page.size(), hugeDelta.data(), hugeDelta.size()), std::runtime_error);
+}
+
+TEST(tools, diffLists)
+{
+    Bitset bitset(20);
+    bitset.set(0);
+    bitset.set(9);
+    bitset.set(19);
+    auto data = bitset.encode();
+    ASSERT_TRUE(Bitset::isEncoded(data.data(), data.size()));
+    ASSERT_FALSE(Bitset::isEncoded("A/path\n", 7));
+    auto decoded = Bitset::decode(data.data(), data.size());
+    ASSERT_EQ(decoded.size(), 20U);
+    for (size_t i = 0; i < 25; ++i) {
+        ASSERT_EQ(decoded.test(i), i == 0 || i == 9 || i == 19);
+    }
+    ASSERT_THROW(Bitset::decode(data.data(), data.size() - 1), std::runtime_error);
+    ASSERT_THROW(bitset.set(20), std::out_of_range);
+    // A size which doesn't match the data is rejected before allocating it.
+    const std::string hugeBitset("\0ZB1\xff\xff\xff\xff\xff\xff\xff\xff\x7f\x01", 14);
+    ASSERT_THROW(Bitset::decode(hugeBitset.data(), hugeBitset.size()), std::runtime_error);
+
+    RedirectListWriter writer;
+    writer.add(0, "A/first");
+    writer.add(300, "A/second");
+    writer.add(100000, "");
+    ASSERT_THROW(writer.add(100000, "A/again"), std::logic_error);
+
+    RedirectListReader reader(writer.data().data(), writer.data().size());
+    ASSERT_TRUE(reader.next());
+    ASSERT_EQ(reader.index(), 0U);
+    ASSERT_EQ(reader.target(), "A/first");
+    ASSERT_FALSE(reader.seek(299));
+    ASSERT_TRUE(reader.seek(300));
+    ASSERT_EQ(reader.target(), "A/second");
+    ASSERT_TRUE(reader.seek(100000));
+    ASSERT_EQ(reader.target(), "");
+    ASSERT_FALSE(reader.seek(100001));
+    ASSERT_FALSE(reader.next());
+}
+
+TEST(tools, removeLinksNamespace)
+{
+    ASSERT_EQ(removeLinksNamespace(""), "");
+    ASSERT_EQ(removeLinksNamespace("no link"), "no link");
+    ASSERT_EQ(removeLinksNamespace("<a href=\"../A/foo.html\">"), "<a href=\"foo.html\">");
+    ASSERT_EQ(removeLinksNamespace("<img src='../I/a.png'>"), "<img src='a.png'>");
+    ASSERT_EQ(removeLinksNamespace("<a href=\"../../A/bar/foo.html\">"), "<a href=\"../bar/foo.html\">");
+    ASSERT_EQ(removeLinksNamespace("<script src=\"../../../J/s.js\">"), "<script src=\"../../s.js\">");
+    ASSERT_EQ(removeLinksNamespace("url('../-/style.css')"), "url('style.css')");
+    ASSERT_EQ(removeLinksNamespace("'../foo/../I/img.png'"), "'img.png'");
+    ASSERT_EQ(removeLinksNamespace("'../../foo/bar/../../A/x'"), "'../x'");
+    ASSERT_EQ(removeLinksNamespace("\"../A/a\" '../I/b' \"../../J/c\""), "\"a\" 'b' \"../c\"");
+
+    // Not a link to a namespace.
+    ASSERT_EQ(removeLinksNamespace("\"A/foo.html\""), "\"A/foo.html\"");
+    ASSERT_EQ(removeLinksNamespace("\"../B/foo.html\""), "\"../B/foo.html\"");
+    ASSERT_EQ(removeLinksNamespace("\"../foo/A/bar.html\""), "\"../foo/A/bar.html\"");
+    ASSERT_EQ(removeLinksNamespace("\"../A\""), "\"../A\"");
+    ASSERT_EQ(removeLinksNamespace("\"../ A/x\""), "\"../ A/x\"");
+    ASSERT_EQ(removeLinksNamespace("'../"), "'../");
 }
 
 TEST(tools, getLinks)